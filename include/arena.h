@@ -0,0 +1,98 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace niubcc{
+
+// Fixed-size array allocated from an Arena, for objects that must stay
+// trivially destructible and so cannot hold a std::vector.
+template<class T>
+struct ArenaArray{
+  T* items{0};
+  std::uint32_t count{0};
+
+  T* begin()const{return items;}
+  T* end()const{return items + count;}
+  std::reverse_iterator<T*> rbegin()const{return std::reverse_iterator<T*>(end());}
+  std::reverse_iterator<T*> rend()const{return std::reverse_iterator<T*>(begin());}
+  std::uint32_t size()const{return count;}
+  bool empty()const{return !count;}
+  T& operator[](std::uint32_t i)const{return items[i];}
+};
+
+// Bump allocator owning every object made from it. Objects are never freed
+// one by one; everything goes away together when the arena is destroyed.
+class Arena{
+private:
+  struct Chunk{
+    Chunk* prev;
+  };
+  // Objects with non-trivial destructors are recorded so they can be
+  // destroyed, newest first, together with the arena.
+  struct Finalizer{
+    void (*destroy)(void*);
+    void* object;
+    Finalizer* prev;
+  };
+
+  static constexpr std::size_t chunk_size = 1 << 16;
+
+  char* cur{0};
+  char* end{0};
+  Chunk* chunks{0};
+  Finalizer* finalizers{0};
+
+  void grow(std::size_t size);
+
+  template<class T>
+  static void destroy(void* object){static_cast<T*>(object)->~T();}
+
+public:
+  Arena() = default;
+  ~Arena();
+  Arena(Arena const&) = delete;
+  Arena& operator=(Arena const&) = delete;
+
+  void* allocate(std::size_t size, std::size_t align){
+    std::size_t pad = -reinterpret_cast<std::size_t>(cur) & (align - 1);
+    if(static_cast<std::size_t>(end - cur) < size + pad){
+      grow(size + align);
+      pad = -reinterpret_cast<std::size_t>(cur) & (align - 1);
+    }
+    void* mem = cur + pad;
+    cur += size + pad;
+    return mem;
+  }
+
+  template<class T, class... Args>
+  T* make(Args&&... args){
+    T* object = new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    if constexpr(!std::is_trivially_destructible_v<T>){
+      finalizers = new(allocate(sizeof(Finalizer), alignof(Finalizer)))
+        Finalizer{&destroy<T>, object, finalizers};
+    }
+    return object;
+  }
+
+  // count value-initialized elements.
+  template<class T>
+  ArenaArray<T> make_array(std::uint32_t count){
+    static_assert(std::is_trivially_destructible_v<T>);
+    auto items = static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    for(std::uint32_t i = 0; i < count; ++i) new(items + i) T();
+    return {items, count};
+  }
+  template<class T>
+  ArenaArray<T> make_array(std::vector<T> const& from){
+    auto array = make_array<T>(from.size());
+    for(std::uint32_t i = 0; i < array.count; ++i) array.items[i] = from[i];
+    return array;
+  }
+};
+
+}
@@ -1,11 +1,18 @@
 #pragma once
 #include <memory>
 #include <string>
+#include <cstdint>
+#include <type_traits>
+#include "arena.h"
 #include "lexer.h"
+#include "utils.h"
 
 namespace niubcc{
 template<class T> using Ptr = std::shared_ptr<T>;
 
+// AST nodes are allocated from an Arena owned by the compilation and are
+// referenced by plain pointers. They are trivially destructible, so the
+// arena releases them all together without running any destructor.
 namespace ast{
 
 #define TOK(X, S)
@@ -24,184 +31,250 @@ inline char const* map_op_name[] = {
 #undef TOK
 #undef OP
 
+// Every node records its concrete type, so visitors dispatch with a switch.
+enum class Kind: unsigned char{
+  Program,
+  FunctionDef,
+  Decl,
+  ForStmtInit,
+  RetStmt,
+  NullStmt,
+  ExprStmt,
+  IfStmt,
+  DoStmt,
+  WhileStmt,
+  ForStmt,
+  Break,
+  Continue,
+  GotoStmt,
+  CompoundStmt,
+  SwitchStmt,
+  CaseStmt,
+  Unary,
+  Binary,
+  Var,
+  Assign,
+  Constant,
+  Condition,
+  Call,
+};
+
 struct FunctionDef;
 struct Stmt;
 struct RetStmt;
 struct Constant;
 struct Expr;
 struct CompoundStmt;
+struct CaseStmt;
+
+// A label written in the source, numbered densely within its function.
+// The spelling is only kept for dumps; name is null where there is none.
+struct UserLabel{
+  char const* name;
+  unsigned name_len;
+  std::uint32_t number;
+};
 
 struct BaseNode{
-  BaseNode() = default;
-  virtual ~BaseNode() = default;
-  virtual std::string print(unsigned) = 0;
+  Kind kind;
+  BaseNode(Kind kind): kind(kind){};
+  // Dump the subtree, walking it with an explicit stack so that deep
+  // expressions and long statement lists do not exhaust the call stack.
+  void dump(utils::Sink& out, unsigned depth=0);
+  std::string print(unsigned depth=0);
 };
 
 struct Block: BaseNode{
-  Ptr<Block> next;
-  Block(Ptr<Block> next): next(next){};
-  virtual std::string print(unsigned) = 0;
+  Block* next;
+  Block(Kind kind, Block* next): BaseNode(kind), next(next){};
 };
 
 struct Stmt: Block{
-  Ptr<std::string> label{0};
-  Stmt(Ptr<Block> next=0): Block(next){};
-  virtual ~Stmt() = default;
-  virtual std::string print(unsigned) = 0;
+  UserLabel label{};
+  Stmt(Kind kind, Block* next=0): Block(kind, next){};
 };
 
+// Variables are resolved by the parser to a dense slot in their function's
+// frame; the spelling is only kept for dumps.
 struct Decl: Block{
-  Ptr<std::string> name;
-  Ptr<Expr> init;
-  Decl(Ptr<std::string> name, Ptr<Expr> init=0, Ptr<Block> next=0)
-  :Block(next), name(name), init(init){};
-  std::string print(unsigned)override;
+  char const* name;
+  unsigned name_len;
+  std::uint32_t slot;
+  Expr* init;
+  Decl(char const* name, unsigned name_len, std::uint32_t slot, Expr* init=0, Block* next=0)
+  :Block(Kind::Decl, next), name(name), name_len(name_len), slot(slot), init(init){};
 };
 
 struct Expr: BaseNode{
-  Expr() = default;
-  virtual ~Expr() = default;
-  virtual std::string print(unsigned) = 0;
+  Expr(Kind kind): BaseNode(kind){};
 };
 
 struct Unary: Expr{
   OpType op_type;
-  Ptr<Expr> expr;
-  Unary(OpType op_type, Ptr<Expr> expr): op_type(op_type), expr(expr){}
-  std::string print(unsigned)override;
+  Expr* expr;
+  Unary(OpType op_type, Expr* expr)
+  :Expr(Kind::Unary), op_type(op_type), expr(expr){}
 };
 
 struct Binary: Expr{
   OpType op_type;
-  Ptr<Expr> lhs;
-  Ptr<Expr> rhs;
-  Binary(OpType op_type, Ptr<Expr> lhs, Ptr<Expr> rhs):
-  op_type(op_type), lhs(lhs), rhs(rhs){}
-  std::string print(unsigned)override;
+  Expr* lhs;
+  Expr* rhs;
+  Binary(OpType op_type, Expr* lhs, Expr* rhs):
+  Expr(Kind::Binary), op_type(op_type), lhs(lhs), rhs(rhs){}
 };
 
 struct Var: Expr{
-  Ptr<std::string> name;
-  Var(Ptr<std::string> name): name(name){}
-  std::string print(unsigned)override;
+  char const* name;
+  unsigned name_len;
+  std::uint32_t slot;
+  Var(char const* name, unsigned name_len, std::uint32_t slot)
+  :Expr(Kind::Var), name(name), name_len(name_len), slot(slot){}
 };
 
 struct Assign: Expr{
-  Ptr<Expr> src;
-  Ptr<Expr> dst;
-  Assign(Ptr<Expr> src, Ptr<Expr> dst): src(src), dst(dst){};
-  std::string print(unsigned)override;
+  Expr* src;
+  Expr* dst;
+  Assign(Expr* src, Expr* dst): Expr(Kind::Assign), src(src), dst(dst){};
 };
 
 struct Program: BaseNode{
-  Ptr<FunctionDef> funcdef;
-  Program(Ptr<FunctionDef> funcdef): funcdef(funcdef){};
-  std::string print(unsigned)override;
+  // In source order.
+  ArenaArray<FunctionDef*> funcdefs;
+  Program(ArenaArray<FunctionDef*> funcdefs)
+  :BaseNode(Kind::Program), funcdefs(funcdefs){};
 };
 
 struct FunctionDef: BaseNode{
   char const* name;
   unsigned name_len;
-  Ptr<CompoundStmt> blocks;
-  FunctionDef(char const* name, unsigned name_len, Ptr<CompoundStmt> blocks)
-  :name(name), name_len(name_len), blocks(blocks){};
-  std::string print(unsigned)override;
+  // Parameters take the first slots, in order.
+  ArenaArray<Var*> params;
+  CompoundStmt* blocks;
+  // Number of variable slots used by the parameters and the body.
+  unsigned var_count;
+  FunctionDef(char const* name, unsigned name_len, ArenaArray<Var*> params,
+    CompoundStmt* blocks, unsigned var_count)
+  :BaseNode(Kind::FunctionDef), name(name), name_len(name_len), params(params),
+  blocks(blocks), var_count(var_count){};
 };
 
 struct RetStmt: Stmt{
-  Ptr<Expr> ret_val;
-  RetStmt(Ptr<Expr> ret_val): ret_val(ret_val){};
-  std::string print(unsigned)override;
+  Expr* ret_val;
+  RetStmt(Expr* ret_val): Stmt(Kind::RetStmt), ret_val(ret_val){};
 };
 
 struct NullStmt: Stmt{
-  NullStmt() = default;
-  std::string print(unsigned)override;
+  NullStmt(): Stmt(Kind::NullStmt){};
 };
 
 struct ExprStmt: Stmt{
-  Ptr<Expr> expr;
-  ExprStmt(Ptr<Expr> expr): expr(expr){};
-  std::string print(unsigned)override;
+  Expr* expr;
+  ExprStmt(Expr* expr): Stmt(Kind::ExprStmt), expr(expr){};
 };
 
 struct IfStmt: Stmt{
-  Ptr<Expr> condition;
-  Ptr<Stmt> then_stmt;
-  Ptr<Stmt> else_stmt;
-  IfStmt(Ptr<Expr> condition, Ptr<Stmt> then_stmt, Ptr<Stmt> else_stmt=0)
-  :condition(condition), then_stmt(then_stmt), else_stmt(else_stmt){}
-  std::string print(unsigned)override;
+  Expr* condition;
+  Stmt* then_stmt;
+  Stmt* else_stmt;
+  IfStmt(Expr* condition, Stmt* then_stmt, Stmt* else_stmt=0)
+  :Stmt(Kind::IfStmt), condition(condition), then_stmt(then_stmt), else_stmt(else_stmt){}
 };
 
 struct DoStmt: Stmt{
-  Ptr<Stmt> stmt;
-  Ptr<Expr> condition;
-  DoStmt(Ptr<Stmt> stmt, Ptr<Expr> condition): stmt(stmt), condition(condition){};
-  std::string print(unsigned)override;
+  Stmt* stmt;
+  Expr* condition;
+  DoStmt(Stmt* stmt, Expr* condition)
+  :Stmt(Kind::DoStmt), stmt(stmt), condition(condition){};
 };
 
 struct WhileStmt: Stmt{
-  Ptr<Stmt> stmt;
-  Ptr<Expr> condition;
-  WhileStmt(Ptr<Stmt> stmt, Ptr<Expr> condition): stmt(stmt), condition(condition){};
-  std::string print(unsigned)override;
+  Stmt* stmt;
+  Expr* condition;
+  WhileStmt(Stmt* stmt, Expr* condition)
+  :Stmt(Kind::WhileStmt), stmt(stmt), condition(condition){};
 };
 
 struct ForStmtInit: BaseNode{
-  Ptr<Decl> decls;
-  Ptr<Expr> expr;
-  ForStmtInit(Ptr<Decl> decls): decls(decls), expr(0){};
-  ForStmtInit(Ptr<Expr> expr): decls(0), expr(expr){};
-  std::string print(unsigned)override;
+  Decl* decls;
+  Expr* expr;
+  ForStmtInit(Decl* decls): BaseNode(Kind::ForStmtInit), decls(decls), expr(0){};
+  ForStmtInit(Expr* expr): BaseNode(Kind::ForStmtInit), decls(0), expr(expr){};
 };
 
 struct ForStmt: Stmt{
-  Ptr<ForStmtInit> init;
-  Ptr<Expr> condition;
-  Ptr<Expr> post;
-  Ptr<Stmt> stmt;
-  ForStmt(Ptr<ForStmtInit> init, Ptr<Expr> condition, Ptr<Expr> post, Ptr<Stmt> stmt)
-  : init(init), condition(condition), post(post), stmt(stmt){};
-  std::string print(unsigned)override;
+  ForStmtInit* init;
+  Expr* condition;
+  Expr* post;
+  Stmt* stmt;
+  ForStmt(ForStmtInit* init, Expr* condition, Expr* post, Stmt* stmt)
+  : Stmt(Kind::ForStmt), init(init), condition(condition), post(post), stmt(stmt){};
 };
 
 struct Break: Stmt{
-  std::string print(unsigned)override;
+  Break(): Stmt(Kind::Break){};
 };
 
 struct Continue: Stmt{
-  std::string print(unsigned)override;
+  Continue(): Stmt(Kind::Continue){};
 };
 
 struct GotoStmt: Stmt{
-  Ptr<std::string> target;
-  GotoStmt(Ptr<std::string> target): target(target){};
-  std::string print(unsigned)override;
+  UserLabel target;
+  GotoStmt(UserLabel target): Stmt(Kind::GotoStmt), target(target){};
 };
 
 struct CompoundStmt: Stmt{
-  Ptr<Block> blocks;
-  CompoundStmt(Ptr<Block> blocks): blocks(blocks){};
-  std::string print(unsigned)override;
+  Block* blocks;
+  CompoundStmt(Block* blocks): Stmt(Kind::CompoundStmt), blocks(blocks){};
+};
+
+// The cases, default included, are listed in source order so the switch
+// can dispatch without searching its body.
+struct SwitchStmt: Stmt{
+  Expr* condition;
+  Stmt* body;
+  ArenaArray<CaseStmt*> cases{};
+  SwitchStmt(Expr* condition, Stmt* body=0)
+  :Stmt(Kind::SwitchStmt), condition(condition), body(body){};
+};
+
+// A case or default label; index is its position in the switch's cases.
+struct CaseStmt: Stmt{
+  std::int64_t value;
+  bool is_default;
+  unsigned index;
+  Stmt* stmt;
+  CaseStmt(std::int64_t value, bool is_default, unsigned index, Stmt* stmt=0)
+  :Stmt(Kind::CaseStmt), value(value), is_default(is_default), index(index), stmt(stmt){};
 };
 
 struct Constant: Expr{
-  char const* value;
-  unsigned value_len;
-  Constant(char const* value, unsigned value_len)
-  :value(value), value_len(value_len){};
-  std::string print(unsigned)override;
+  std::int64_t value;
+  Constant(std::int64_t value): Expr(Kind::Constant), value(value){};
+};
+
+struct Call: Expr{
+  char const* name;
+  unsigned name_len;
+  ArenaArray<Expr*> args;
+  Call(char const* name, unsigned name_len, ArenaArray<Expr*> args)
+  :Expr(Kind::Call), name(name), name_len(name_len), args(args){};
 };
 
 struct Condition: Expr{
-  Ptr<Expr> condition;
-  Ptr<Expr> true_val;
-  Ptr<Expr> false_val;
-  Condition(Ptr<Expr> condition, Ptr<Expr> true_val, Ptr<Expr> false_val)
-  :condition(condition), true_val(true_val), false_val(false_val){};
-  std::string print(unsigned)override;
+  Expr* condition;
+  Expr* true_val;
+  Expr* false_val;
+  Condition(Expr* condition, Expr* true_val, Expr* false_val)
+  :Expr(Kind::Condition), condition(condition), true_val(true_val), false_val(false_val){};
 };
 
+template<class... Nodes>
+constexpr bool trivially_destructible = (std::is_trivially_destructible_v<Nodes> && ...);
+static_assert(trivially_destructible<Program, FunctionDef, Decl, ForStmtInit, RetStmt, NullStmt,
+  ExprStmt, IfStmt, DoStmt, WhileStmt, ForStmt, Break, Continue, GotoStmt, CompoundStmt,
+  SwitchStmt, CaseStmt, Unary, Binary, Var, Assign, Constant, Condition, Call>);
+
 }
 }
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.h"
+
+namespace niubcc{
+namespace codegen{
+
+// The -O0 tier: assembly straight from the AST in a single pass, with no
+// TACKY in between. Expressions run on a stack machine: every value ends
+// up in %eax, and an operand waiting for its sibling is pushed.
+class BaselineGenerator{
+private:
+  std::string code{};
+  unsigned label_count{0};
+  // Words pushed by the expression being generated, for call alignment.
+  unsigned pushed{0};
+  // Targets of break and continue; a switch passes on the continue label
+  // of the loop around it.
+  struct Loop{
+    unsigned continue_label;
+    unsigned break_label;
+  };
+  std::vector<Loop> loops{};
+  // First label of the cases of each switch being generated; a case is
+  // at that label plus its index.
+  std::vector<unsigned> case_bases{};
+  // Labels written in the source of the current function.
+  std::unordered_map<std::uint32_t, unsigned> user_labels{};
+
+  unsigned new_label(){return label_count++;}
+  unsigned user_label(ast::UserLabel const& label);
+
+  template<class... Args>
+  void emit(Args const&... pieces){utils::append(code, pieces...);}
+  void emit_label(unsigned label){emit(".L", label, ":\n");}
+  void emit_epilogue(){emit("movq\t%rbp, %rsp\n", "popq\t%rbp\n", "ret\n");}
+
+  void generate(ast::FunctionDef*);
+  void generate(ast::Block*);
+  void generate(ast::Stmt*);
+  void generate(ast::ForStmtInit*);
+  // Leaves the value in %eax.
+  void generate(ast::Expr*);
+  // Jumps to label if the expression is zero.
+  void generate_jz(ast::Expr*, unsigned label);
+
+public:
+  void generate(ast::Program*);
+  void emie_code(char const* filename)const;
+};
+
+}
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace niubcc{
+
+// Fixed-size set of small integers, for dataflow facts.
+class BitSet{
+private:
+  std::vector<std::uint64_t> words;
+
+public:
+  BitSet(std::size_t size, bool full)
+  :words((size + 63) / 64, full ? ~std::uint64_t{0} : 0){}
+
+  bool test(std::uint32_t i)const{return words[i / 64] >> (i % 64) & 1;}
+  void set(std::uint32_t i){words[i / 64] |= std::uint64_t{1} << (i % 64);}
+  void reset(std::uint32_t i){words[i / 64] &= ~(std::uint64_t{1} << (i % 64));}
+  void clear(){for(auto& word: words) word = 0;}
+  void intersect(BitSet const& other){
+    for(std::size_t i = 0; i < words.size(); ++i) words[i] &= other.words[i];
+  }
+  void unite(BitSet const& other){
+    for(std::size_t i = 0; i < words.size(); ++i) words[i] |= other.words[i];
+  }
+  bool operator==(BitSet const& other)const{return words == other.words;}
+  bool operator!=(BitSet const& other)const{return words != other.words;}
+};
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "tacky.h"
+#include "utils.h"
+
+namespace niubcc{
+namespace ir{
+
+struct BasicBlock{
+  // Leading Labels included; at most the last instruction transfers
+  // control, and a block that does not end in Jmp, Ret or JumpTable falls
+  // through to the next one in layout order.
+  std::vector<Inst> insts{};
+  std::vector<std::uint32_t> succs{};
+  std::vector<std::uint32_t> preds{};
+  // Position in reverse postorder, none if unreachable from the entry.
+  std::uint32_t rpo_index;
+  // Immediate dominator; the entry is its own, unreachable blocks have none.
+  std::uint32_t idom;
+};
+
+// Control-flow graph of one function. Blocks are kept in layout order
+// with the entry first, so that linearizing concatenates them; passes
+// edit instructions in place and call analyze when they change edges.
+class Cfg{
+public:
+  static constexpr std::uint32_t none = ~0u;
+
+  std::vector<BasicBlock> blocks{};
+  // Reachable blocks in reverse postorder.
+  std::vector<std::uint32_t> rpo{};
+  // Block starting with each label, none if the label is not placed.
+  std::vector<std::uint32_t> label_blocks{};
+
+  static Cfg build(FunctionDef const& fn);
+  // Recompute edges, the order and dominators from the instructions.
+  void analyze(FunctionDef const& fn);
+  // Write the blocks back as the function's instruction list.
+  void linearize(FunctionDef& fn)const;
+
+  bool reachable(std::uint32_t block)const{return blocks[block].rpo_index != none;}
+  bool dominates(std::uint32_t a, std::uint32_t b)const;
+  // Whether control can pass from the end of block to the next one.
+  static bool falls_through(BasicBlock const& block);
+
+  void dump(utils::Sink& out, FunctionDef const& fn)const;
+
+private:
+  void link(FunctionDef const& fn);
+  void order();
+  void compute_dominators();
+};
+
+}
+}
@@ -1,9 +1,12 @@
 #pragma once
 #include <memory>
 #include <vector>
+#include "inliner.h"
 #include "tacky.h"
+#include "utils.h"
 
 namespace niubcc{
+class ThreadPool;
 
 namespace codegen{
 enum class OperandType{
@@ -14,21 +17,40 @@ enum class OperandType{
 
 struct Operand{
   OperandType type;
-  std::string repr;
-  Operand(OperandType type, std::string const& repr): type(type), repr(repr){}
+  // Imm: the constant. Mem: the offset below %rbp.
+  std::int64_t value;
+  // Reg: the register name.
+  char const* reg;
+  Operand(OperandType type, std::int64_t value): type(type), value(value), reg(0){}
+  Operand(OperandType type, char const* reg): type(type), value(0), reg(reg){}
 };
 
+// Writes the operand in AT&T syntax; used through utils::append.
+void append_one(std::string& out, Operand const& op);
+
+// Write finished assembly to filename, terminating if it cannot be created.
+void write_code(std::string const& code, char const* filename);
+
 class AsmGenerator{
 private:
-  std::vector<std::string> codes{};
+  // Finished output, and the body of the function being generated.
+  std::string code{};
+  std::string body{};
   unsigned stack_allocated{0};
+  // Added to the function-local label numbers.
+  unsigned label_base{0};
+  // The function being generated, for its constants and pools.
+  ir::FunctionDef const* fn{0};
   unsigned allocate_stack(unsigned tmp){
     unsigned stack_pos = (tmp + 1) * 4;
     stack_allocated = stack_allocated > stack_pos ? stack_allocated : stack_pos;
     return stack_pos;
   }
 
-  Operand get_operand(Ptr<ir::Val>);
+  Operand get_operand(ir::Val);
+
+  template<class... Args>
+  void emit(Args const&... pieces){utils::append(body, pieces...);}
 
   void emit_mov(Operand const&, Operand const&);
   void emit_cmp(Operand const&, Operand const&);
@@ -38,30 +60,29 @@ private:
     return "%%r11d";
   }
 
-  void emit_bin_op(std::string const&, Operand const&, Operand const&);
+  void emit_bin_op(char const*, Operand const&, Operand const&);
 
-  void gen_mul_inst(Ptr<ir::Binary>);
-  void gen_div_inst(Ptr<ir::Binary>);
-  void gen_bin_inst(Ptr<ir::Binary>, std::string const&);
-  void gen_cond_inst(Ptr<ir::Binary>);
-  void gen_cond_inst(Ptr<ir::Unary>);
+  void gen_mul_inst(ir::Inst const&);
+  void gen_div_inst(ir::Inst const&);
+  void gen_bin_inst(ir::Inst const&, char const*);
+  void gen_cond_inst(ir::Inst const&);
+  void gen_not_inst(ir::Inst const&);
+
+  void gen_unary(ir::Inst const&);
+  void gen_binary(ir::Inst const&);
+  void gen_jump(ir::Inst const&);
+  void gen_call(ir::Inst const&);
+  void gen_jump_table(ir::Inst const&);
+  void gen_ret(ir::Inst const&);
 
 public:
-  void generate(Ptr<ir::Base>);
-  void generate(Ptr<ir::Program>);
-  void generate(Ptr<ir::FunctionDef>);
-  void generate(Ptr<ir::Inst>);
-  void generate(Ptr<ir::Unary>);
-  void generate(Ptr<ir::Ret>);
-  void generate(Ptr<ir::Binary>);
-  void generate(Ptr<ir::Copy>);
-  void generate(Ptr<ir::Jmp>);
-  void generate(Ptr<ir::Jnz>);
-  void generate(Ptr<ir::Jz>);
-  void generate(Ptr<ir::Label>);
-  std::string generate(Ptr<ir::Val>);
-  std::string generate(Ptr<ir::Var>);
-  std::string generate(Ptr<ir::Constant>);
+  void generate(ir::Program*);
+  void generate(ir::FunctionDef const&);
+
+  // Lower, inline, optimize and generate the functions on the pool.
+  // The output is the same as generating the whole program in order.
+  void generate_parallel(ast::Program*, ThreadPool&,
+    unsigned inline_budget=ir::default_inline_budget);
 
   void emie_code(char const* filename)const;
 };
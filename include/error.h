@@ -1,6 +1,7 @@
 #pragma once
 #include <string>
 #include <memory>
+#include <new>
 #include <type_traits>
 
 namespace niubcc{
@@ -8,41 +9,71 @@ namespace niubcc{
 class Error{
 protected:
   char const* msg;
+  // Errors are always held by their concrete type, never deleted through
+  // Error*, so the destructor can stay trivial.
+  ~Error() = default;
 public:
   Error(char const* msg): msg(msg){};
   Error(Error const&) = delete;
   Error(Error&& oth) noexcept = default;
   Error& operator=(Error const&) = delete;
   Error& operator=(Error&&) = delete;
-  virtual ~Error() = default;
 
   virtual std::string to_string() const = 0;
 };
 
+namespace detail{
+// The value or the error, stored inline. Only destroys the active member
+// when one of them needs it, so a pointer result costs no destructor call.
 template<class T, class E,
-class=std::enable_if_t<std::is_base_of_v<Error, E> > >
-class Expected{
-private:
+bool=std::is_trivially_destructible_v<T> && std::is_trivially_destructible_v<E> >
+struct ExpectedStorage{
   bool has_error;
   union{
     T value;
-    std::unique_ptr<E> error;
+    E error;
   };
-public:
-  Expected(T&& value):
-  value(std::move(value)), has_error(false){};
-  Expected(E err):
-  error(std::make_unique<E>(std::move(err))), has_error(true){};
-  ~Expected(){
+  ExpectedStorage(T&& value): has_error(false), value(std::move(value)){};
+  ExpectedStorage(E&& error): has_error(true), error(std::move(error)){};
+  ExpectedStorage(ExpectedStorage&& oth) noexcept: has_error(oth.has_error){
+    if(has_error) new(&error) E(std::move(oth.error));
+    else new(&value) T(std::move(oth.value));
+  }
+  ~ExpectedStorage(){
     if(!has_error) value.~T();
-    else std::destroy_at(&error);
+    else error.~E();
   }
-  Expected(Expected<T, E> const&) = delete;
-  Expected& operator=(Expected<T, E> const&) = delete;
-  Expected(Expected<T, E>&& oth) noexcept: has_error(oth.has_error){
-    if(has_error) new(&error) std::unique_ptr(std::move(oth.error));
+};
+
+template<class T, class E>
+struct ExpectedStorage<T, E, true>{
+  bool has_error;
+  union{
+    T value;
+    E error;
+  };
+  ExpectedStorage(T&& value): has_error(false), value(std::move(value)){};
+  ExpectedStorage(E&& error): has_error(true), error(std::move(error)){};
+  ExpectedStorage(ExpectedStorage&& oth) noexcept: has_error(oth.has_error){
+    if(has_error) new(&error) E(std::move(oth.error));
     else new(&value) T(std::move(oth.value));
   }
+};
+}
+
+template<class T, class E,
+class=std::enable_if_t<std::is_base_of_v<Error, E> > >
+class [[nodiscard]] Expected: detail::ExpectedStorage<T, E>{
+  using Storage = detail::ExpectedStorage<T, E>;
+  using Storage::has_error;
+  using Storage::value;
+  using Storage::error;
+public:
+  Expected(T&& value): Storage(std::move(value)){};
+  Expected(E err): Storage(std::move(err)){};
+  Expected(Expected<T, E> const&) = delete;
+  Expected& operator=(Expected<T, E> const&) = delete;
+  Expected(Expected&& oth) noexcept = default;
   Expected& operator=(Expected<T, E>&& oth){
     if(this == &oth) return *this;
     this->~Expected();
@@ -63,8 +94,7 @@ public:
       fprintf(stderr, "UnwrapErr a Expected which contains Value.\n");
       std::terminate();
     }
-    return std::move(*error);
-
+    return std::move(error);
   }
 
   bool is_ok() const{
@@ -78,7 +108,7 @@ public:
   template<class F, class=std::enable_if_t<std::is_invocable_v<F, E> > >
   void handle_err(F&& f){
     if(!has_error) return;
-    f(*error);
+    f(error);
   }
 
 };
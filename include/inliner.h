@@ -0,0 +1,18 @@
+#pragma once
+#include "tacky.h"
+
+namespace niubcc{
+namespace ir{
+
+// Callees of at most this many instructions are always worth inlining.
+constexpr unsigned small_function_size = 16;
+constexpr unsigned default_inline_budget = 256;
+
+// Replace calls to functions defined in the program with a copy of the
+// callee's body, when the callee is small or has a single call site and
+// the caller grows by at most budget instructions. Each caller is scanned
+// once and copied bodies are not rescanned, so recursion stays bounded.
+void inline_calls(Program* program, unsigned budget=default_inline_budget);
+
+}
+}
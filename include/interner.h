@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace niubcc{
+
+// Maps each distinct identifier spelling to a dense 32-bit id.
+// Spellings are views into the source buffer, which must outlive the interner.
+class Interner{
+private:
+  struct Slot{
+    std::uint32_t hash;
+    std::uint32_t id; // id + 1, zero marks an empty slot
+  };
+  std::vector<Slot> slots;
+  std::vector<std::string_view> spellings{};
+  std::vector<std::uint32_t> hashes{};
+
+  void grow();
+
+public:
+  static constexpr std::uint32_t hash_seed = 2166136261u;
+  // FNV-1a, fed one character at a time so the lexer can hash while scanning.
+  static std::uint32_t hash_step(std::uint32_t hash, char c){
+    return (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+  }
+  static std::uint32_t hash(std::string_view spelling){
+    std::uint32_t h = hash_seed;
+    for(char c: spelling) h = hash_step(h, c);
+    return h;
+  }
+
+  Interner(): slots(64){};
+
+  std::uint32_t intern(std::string_view spelling, std::uint32_t hash);
+  std::uint32_t intern(std::string_view spelling){
+    return intern(spelling, hash(spelling));
+  }
+  std::string_view spelling(std::uint32_t id)const{return spellings[id];}
+  std::uint32_t hash_of(std::uint32_t id)const{return hashes[id];}
+  unsigned size()const{return spellings.size();}
+};
+
+}
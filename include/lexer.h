@@ -1,13 +1,21 @@
 #pragma once
 #include <string>
-#include <vector>
 #include <optional>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <vector>
 #include "error.h"
+#include "interner.h"
 #include "utils.h"
 
 namespace niubcc{
 
+class Lexer;
+class ThreadPool;
+
 class LexerError: Error{
+  friend class Lexer;
 private:
   utils::Pos pos;
 public:
@@ -24,8 +32,6 @@ enum class TokenType: unsigned short{
 #undef TOK
 #undef OP
 
-class Lexer;
-
 class Token{
   friend class Lexer;
 private:
@@ -40,11 +46,19 @@ private:
 
   unsigned addtional_len;
 
+  union{
+    // Decoded value of an integer literal.
+    std::uint64_t int_value;
+    // Interned id of an identifier.
+    std::uint32_t ident_id;
+  };
+
   static char const* token_name_map[];
 
   void init(); 
 
-  std::optional<std::string> fmt()const;
+  // One line of the --lex listing, without the newline.
+  void dump(utils::Sink& out)const;
 
 public:
   Token() = default;
@@ -69,39 +83,93 @@ public:
   TokenType get_type()const{
     return type;
   } 
+  std::uint64_t get_int_value()const{return int_value;}
+  std::uint32_t get_ident_id()const{return ident_id;}
 };
 
 class Lexer{
 private:
   unsigned col{1};
   unsigned line{1};
-  unsigned tok_pos{0};
-  unsigned tok_max_len;
   char const* text_ptr;
   char const* cur_ptr;
-  std::vector<Token> tokens;
+  // Set only for chunk lexers, whose input is not terminated by EOF.
+  char const* end_ptr{0};
+
+  // Keywords are interned first, so an id below keyword_count is a keyword.
+  Interner interner{};
+  static unsigned const keyword_count;
+
+  // Tokens are produced on demand into a small ring buffer, so the parser
+  // gets its lookahead without the whole token stream being materialized.
+  static constexpr unsigned ring_size = 4;
+  Token ring[ring_size];
+  unsigned ring_head{0};
+  unsigned ring_count{0};
 
-  Expected<bool, LexerError> lex_one_token();
+  void fill(unsigned count);
+
+  // Tokens lexed up front by tokenize_parallel, or the batch last received
+  // from the lexer thread in pipelined mode, served in order by fill.
+  std::vector<Token> lexed{};
+  std::size_t lexed_pos{0};
+  bool is_pre_lexed{false};
+
+  struct Pipeline;
+  std::unique_ptr<Pipeline> pipeline;
+  static constexpr unsigned pipeline_batch = 256;
+  void produce();
+  void receive();
+
+  static constexpr unsigned long min_chunk_size = 1ul << 16;
+
+  Lexer(char const* begin, char const* end);
+  Expected<bool, LexerError> lex_chunk(std::vector<Token>& out);
+
+  Expected<bool, LexerError> lex_one_token(Token& token);
   bool skip_whitespace();
-  bool lex_number(Token& token);
+  Expected<bool, LexerError> lex_number(Token& token);
   bool lex_ident_or_kw(Token& token);
   bool is_valid_ident_char(char c);
 
   static void err_handler(LexerError const& err);
 
 public:
-  Lexer(char const* _ptr, unsigned _tok_max_len):
-  text_ptr(_ptr), tok_max_len(_tok_max_len), tokens(_tok_max_len){};
-  ~Lexer() = default;
-  
-  void tokenize();
-
-  std::vector<Token> const& get_tokens()const;
-  std::vector<Token>& get_tokens_out();
-  void display_all_tokens()const;
-
-  unsigned get_token_vec_len()const{return tok_pos;}
-  void reset_token_vec_len(){tok_pos = 0;}
+  Lexer(char const* _ptr);
+  Lexer(Lexer&&);
+  ~Lexer();
+
+  // Look at the k-th upcoming token without consuming it.
+  // Past the end of input the token type is TokenType::unknown.
+  Token const& peek(unsigned k=0){
+    assert(k + 1 < ring_size);
+    if(k >= ring_count) fill(k + 1);
+    return ring[(ring_head + k) % ring_size];
+  }
+  void consume(){
+    if(!ring_count) fill(1);
+    ring_head = (ring_head + 1) % ring_size;
+    --ring_count;
+  }
+  // The most recently consumed token.
+  Token const& last()const{
+    return ring[(ring_head + ring_size - 1) % ring_size];
+  }
+
+  void display_all_tokens();
+
+  // Optionally lex the whole input of the given length up front, split into
+  // chunks at whitespace boundaries and lexed concurrently on the pool.
+  // Must be called before any token is requested.
+  void tokenize_parallel(ThreadPool& pool, unsigned long length);
+
+  // Optionally run the lexer on its own thread, overlapping lexing with
+  // parsing. Tokens are handed over in batches through a lock-free ring.
+  // Must be called before any token is requested, and the interner may
+  // only be inspected once all tokens have been consumed.
+  void start_pipeline();
+
+  Interner const& get_interner()const{return interner;}
 };
 
 }
\ No newline at end of file
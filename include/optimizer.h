@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include "tacky.h"
+
+namespace niubcc{
+namespace ir{
+
+// Dataflow passes only look within blocks when a function has more block
+// and fact pairs than this.
+constexpr std::size_t max_dataflow_bits = std::size_t{1} << 27;
+
+// The value of a unary or binary operator, other than && and ||, on
+// 32-bit two's complement ints, or none where C leaves it undefined.
+std::optional<std::int32_t> fold_unary(ast::OpType op, std::int32_t value);
+std::optional<std::int32_t> fold_binary(ast::OpType op, std::int32_t lhs, std::int32_t rhs);
+
+// Evaluate Unary and Binary instructions on constants as 32-bit two's
+// complement ints, and turn Jz, Jnz and JumpTable on constants into jumps
+// or drop them. Operations that are undefined on their constants, such as
+// division by zero, are left for run time. Vars other than parameters
+// that are assigned once take the constant they are assigned. Returns
+// whether anything changed.
+bool fold_constants(FunctionDef& fn);
+
+// Rewrite uses of the destination of a Copy to its source wherever the
+// copy reaches on every path, then drop copies that are no-ops or whose
+// destination is no longer read. Returns whether anything changed.
+bool propagate_copies(FunctionDef& fn);
+
+// Delete Unary, Binary and Copy instructions whose result is dead, using
+// liveness of Vars over the CFG, until none is left. Returns whether
+// anything changed.
+bool eliminate_dead_code(FunctionDef& fn);
+
+// Remove unreachable blocks and labels nothing jumps to, thread jumps
+// through blocks that only jump, drop jumps to the next block and move
+// blocks reached by a single Jmp in its place. Returns whether anything
+// changed.
+bool simplify_cfg(FunctionDef& fn);
+
+// Run the passes over fn until none of them changes anything.
+void optimize(FunctionDef& fn);
+
+}
+}
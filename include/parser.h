@@ -3,7 +3,10 @@
 #include "ast.h"
 #include "error.h"
 #include "symbol_table.h"
+#include "arena.h"
 #include <memory>
+#include <unordered_set>
+#include <vector>
 
 namespace niubcc{
 
@@ -18,8 +21,8 @@ public:
 class Parser{
 private:
   SymbolTable symbol_table{};
-  std::vector<Token> tokens;
-  unsigned tok_pos;
+  Lexer& lexer;
+  Arena& arena;
 
   static void error_handler(ParseError const& err);
 
@@ -27,8 +30,8 @@ private:
 
   ast::OpType convert_token_to_op(TokenType tokentype)const;
 
-  utils::Pos get_cur_tok_pos()const{return tokens[tok_pos].get_pos();};
-  TokenType get_cur_tok_type()const{return tokens[tok_pos].get_type();};
+  utils::Pos get_cur_tok_pos()const{return lexer.peek().get_pos();};
+  TokenType get_cur_tok_type()const{return lexer.peek().get_type();};
 
   bool match(TokenType type);
 
@@ -37,7 +40,7 @@ private:
     return match(type) && match(types...);
   }
 
-  bool next_is(TokenType type){return tokens[tok_pos].is(type);}
+  bool next_is(TokenType type){return lexer.peek().is(type);}
 
   template<class... Args>
   bool next_is(TokenType type, Args... types){
@@ -58,28 +61,56 @@ private:
   // Represent current loop depth, used for detecting bad break and continue.
   unsigned loop_depth{0};
 
-  Expected<Ptr<ast::Program>, ParseError> parse_program();
-  Expected<Ptr<ast::FunctionDef>, ParseError> parse_funcdef();
-  Expected<Ptr<ast::Block>, ParseError> parse_block();
-  Expected<Ptr<ast::Decl>, ParseError> parse_decl();
-  Expected<Ptr<ast::Decl>, ParseError> parse_decl_init_list();
-  Expected<Ptr<ast::Stmt>, ParseError> parse_stmt();
-  Expected<Ptr<ast::CompoundStmt>, ParseError> parse_compoundstmt();
-  Expected<Ptr<ast::ExprStmt>, ParseError> parse_exprstmt();
-  Expected<Ptr<ast::RetStmt>, ParseError> parse_retstmt();
-  Expected<Ptr<ast::IfStmt>, ParseError> parse_ifstmt();
-  Expected<Ptr<ast::DoStmt>, ParseError> parse_dostmt();
-  Expected<Ptr<ast::WhileStmt>, ParseError> parse_whilestmt();
-  Expected<Ptr<ast::ForStmt>, ParseError> parse_forstmt();
-  Expected<Ptr<ast::ForStmtInit>, ParseError> parse_forinit();
-  Expected<Ptr<ast::GotoStmt>, ParseError> parse_gotostmt();
-  Expected<Ptr<ast::Expr>, ParseError> parse_expr(unsigned precedence=0);
-  Expected<Ptr<ast::Expr>, ParseError> parse_condition(unsigned precedence=0);
-  Expected<Ptr<ast::Expr>, ParseError> parse_factor();
-  Expected<Ptr<ast::Unary>, ParseError> parse_unary();
+  // Enclosing switch statements, innermost last, with the cases and case
+  // values seen so far.
+  struct SwitchContext{
+    ast::SwitchStmt* node{0};
+    std::vector<ast::CaseStmt*> cases{};
+    std::unordered_set<std::int64_t> values{};
+    bool has_default{false};
+  };
+  std::vector<SwitchContext> switches{};
+
+  // An operator still waiting for its right operand, or an open
+  // parenthesis, in the expression being parsed. precedence is the
+  // minimum precedence to resume with once the operand is complete.
+  struct ExprFrame{
+    enum class Type: unsigned char{Paren, Unary, Binary, Assign, CondTrue, CondFalse, Call};
+    Type type;
+    ast::OpType op{};
+    unsigned precedence{0};
+    ast::Expr* lhs{0}; // Call: the call collecting its arguments.
+    ast::Expr* mid{0};
+    unsigned arg_count{0}; // Call: arguments parsed so far.
+  };
+  // Reused by every parse_expr, which keeps expressions off the call stack.
+  std::vector<ExprFrame> expr_frames{};
+
+  Expected<ast::Program*, ParseError> parse_program();
+  // Null for a declaration without a body.
+  Expected<ast::FunctionDef*, ParseError> parse_funcdef();
+  Expected<ast::Block*, ParseError> parse_block();
+  Expected<ast::Decl*, ParseError> parse_decl();
+  Expected<ast::Decl*, ParseError> parse_decl_init_list();
+  Expected<ast::Stmt*, ParseError> parse_stmt();
+  // A function body opens no scope of its own; it uses the parameters'.
+  Expected<ast::CompoundStmt*, ParseError> parse_compoundstmt(bool new_scope=true);
+  Expected<ast::ExprStmt*, ParseError> parse_exprstmt();
+  Expected<ast::RetStmt*, ParseError> parse_retstmt();
+  Expected<ast::IfStmt*, ParseError> parse_ifstmt();
+  Expected<ast::DoStmt*, ParseError> parse_dostmt();
+  Expected<ast::WhileStmt*, ParseError> parse_whilestmt();
+  Expected<ast::ForStmt*, ParseError> parse_forstmt();
+  Expected<ast::ForStmtInit*, ParseError> parse_forinit();
+  Expected<ast::GotoStmt*, ParseError> parse_gotostmt();
+  Expected<ast::SwitchStmt*, ParseError> parse_switchstmt();
+  Expected<ast::CaseStmt*, ParseError> parse_casestmt(bool is_default);
+  Expected<ast::Expr*, ParseError> parse_expr(unsigned precedence=0);
+  Expected<ast::Expr*, ParseError> parse_factor(unsigned& precedence);
 public:
-  Parser(Lexer& lexer);
-  Ptr<ast::Program> parse();
+  // Every AST node is allocated from the arena, which must outlive the AST.
+  Parser(Lexer& lexer, Arena& arena);
+  ast::Program* parse();
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace niubcc{
+
+// Lock-free bounded ring for exactly one producer thread and one consumer
+// thread. Items are moved in batches, and each side publishes its index
+// once per batch.
+template<class T>
+class SpscQueue{
+private:
+  std::vector<T> slots;
+  std::size_t mask;
+  alignas(64) std::atomic<std::size_t> head{0}; // written by the consumer
+  alignas(64) std::atomic<std::size_t> tail{0}; // written by the producer
+  // Each side's last observation of the other's index, so the shared
+  // cache line is only touched when the ring looks full or empty.
+  alignas(64) std::size_t producer_head{0};
+  alignas(64) std::size_t consumer_tail{0};
+
+public:
+  // The capacity is rounded up to a power of two.
+  explicit SpscQueue(std::size_t capacity){
+    std::size_t size = 1;
+    while(size < capacity) size <<= 1;
+    slots.resize(size);
+    mask = size - 1;
+  }
+  SpscQueue(SpscQueue const&) = delete;
+  SpscQueue& operator=(SpscQueue const&) = delete;
+
+  // Push up to n items, returning how many fit.
+  std::size_t push(T const* items, std::size_t n){
+    std::size_t t = tail.load(std::memory_order_relaxed);
+    if(slots.size() - (t - producer_head) < n)
+      producer_head = head.load(std::memory_order_acquire);
+    std::size_t space = slots.size() - (t - producer_head);
+    if(n > space) n = space;
+    for(std::size_t i = 0; i < n; ++i) slots[(t + i) & mask] = items[i];
+    tail.store(t + n, std::memory_order_release);
+    return n;
+  }
+
+  // Pop up to n items into out, returning how many were available.
+  std::size_t pop(T* out, std::size_t n){
+    std::size_t h = head.load(std::memory_order_relaxed);
+    if(consumer_tail - h < n)
+      consumer_tail = tail.load(std::memory_order_acquire);
+    std::size_t avail = consumer_tail - h;
+    if(n > avail) n = avail;
+    for(std::size_t i = 0; i < n; ++i) out[i] = slots[(h + i) & mask];
+    head.store(h + n, std::memory_order_release);
+    return n;
+  }
+};
+
+}
@@ -1,51 +1,71 @@
 #pragma once
-#include <string_view>
+#include <cstdint>
 #include <unordered_map>
-#include <memory>
 #include <optional>
+#include <vector>
 #include "utils.h"
 #include "error.h"
 
 namespace niubcc{
 
-class SymbolTable;
-
-class Scope{
-friend class SymbolTable;
-  std::unordered_map<std::string_view, std::shared_ptr<std::string> > table{};
-  std::shared_ptr<Scope> outer;
-public:
-  Scope(std::shared_ptr<Scope> outer=0): outer(outer){};
-};
-
 struct LabelEntry{
   utils::Pos pos;
-  std::shared_ptr<std::string> name;
+  std::uint32_t number;
+  bool is_defined;
+};
+
+struct FunctionEntry{
+  unsigned param_count;
   bool is_defined;
 };
 
 class SymbolTable{
-  std::shared_ptr<Scope> cur_scope;
+  // A declaration visible in the current scope or shadowed by an inner one.
+  struct Binding{
+    std::uint32_t id;
+    std::uint32_t shadowed; // Binding it hides for the same id, or no_binding.
+    std::uint32_t slot;
+  };
+  static constexpr std::uint32_t no_binding = ~0u;
+  // Innermost binding of each interned id. Ids are dense, so the table is
+  // indexed by id directly.
+  std::vector<std::uint32_t> innermost{};
+  // Every live binding in declaration order; leaving a scope pops back to
+  // where the scope started and undoes the shadowing.
+  std::vector<Binding> bindings{};
+  std::vector<std::uint32_t> scope_starts{};
   // Only need single label map, because label is in function scope.
-  std::unordered_map<std::string_view, LabelEntry> labels{};
+  std::unordered_map<std::uint32_t, LabelEntry> labels{};
+  // Functions declared or defined so far, by id.
+  std::unordered_map<std::uint32_t, FunctionEntry> functions{};
   bool in_func{false}; // For judge a legal label.
 
-  unsigned tmp_num{0};
-  unsigned label_num{0};
-  std::string make_tmp_name(char const* name, unsigned len);
-  std::string make_label_name(char const* name, unsigned len);
+  // Variables get consecutive slots within a function.
+  unsigned var_count{0};
 public:
-  SymbolTable(){
-    cur_scope = std::make_shared<Scope>();
-  }
-  std::shared_ptr<std::string> lookup_and_add(char const* name, unsigned len);
-  std::shared_ptr<std::string> lookup_and_get(char const* name, unsigned len);
-  std::shared_ptr<std::string> define_label(char const* name, unsigned len, utils::Pos pos);
-  std::shared_ptr<std::string> add_label(char const* name, unsigned len, utils::Pos pos);
+  // Give a new variable the next slot; nullopt if the scope already has it.
+  std::optional<std::uint32_t> lookup_and_add(std::uint32_t id);
+  std::optional<std::uint32_t> lookup_and_get(std::uint32_t id);
+  unsigned get_var_count()const{return var_count;}
+  // Labels are numbered densely in the order they are first seen in a
+  // function. define_label gives nullopt if the label is already defined.
+  std::optional<std::uint32_t> define_label(std::uint32_t id, utils::Pos pos);
+  std::uint32_t add_label(std::uint32_t id, utils::Pos pos);
   std::optional<utils::Pos> resolve_all_labels();
   void enter_scope();
   void leave_scope();
-  void call_func(){in_func = true;}
+  // Null if no function of that name has been declared.
+  FunctionEntry* lookup_function(std::uint32_t id){
+    auto it = functions.find(id);
+    return it == functions.end() ? 0 : &it->second;
+  }
+  FunctionEntry& add_function(std::uint32_t id, unsigned param_count){
+    return functions.try_emplace(id, FunctionEntry{param_count, false}).first->second;
+  }
+  void call_func(){
+    in_func = true;
+    var_count = 0;
+  }
   void ret_func(){
     in_func = false;
     labels.clear();
@@ -1,179 +1,187 @@
 #pragma once
 #include "assert.h"
 #include "ast.h"
+#include "utils.h"
+#include <cstdint>
 #include <unordered_map>
+#include <vector>
 
 namespace niubcc{
 namespace ir{
 
-struct FunctionDef;
-struct Inst;
-struct Ret;
-struct Val;
-struct Unary;
-struct Constant;
-struct Var;
-
-struct Base{
-  virtual ~Base() = default;
-};
-
-struct Program: Base{
-  Ptr<FunctionDef> funcdef;
-  Program(Ptr<FunctionDef> funcdef):funcdef(funcdef){};
-  void print();
+// TACKY is stored per function in flat arrays: instructions are fixed-size
+// records, operands are tagged 32-bit Vals and labels are numbers. The few
+// parts of variable size, call arguments and jump tables, live in side
+// pools of the function that instructions index.
+enum class Kind: unsigned char{
+  Ret,        // src_1
+  Unary,      // op, src_1, dst
+  Binary,     // op, src_1, src_2, dst
+  Label,      // target
+  Jmp,        // target
+  Jnz,        // target, src_1
+  Jz,         // target, src_1
+  Copy,       // src_1, dst
+  Call,       // target: index into calls, dst
+  JumpTable,  // target: index into tables, src_1: the index
+};
+
+// A Var number, or with the top bit set an index into the function's
+// constant pool.
+struct Val{
+  static constexpr std::uint32_t constant_bit = 1u << 31;
+  std::uint32_t bits{~0u};
+
+  static Val var(std::uint32_t number){return Val{number};}
+  static Val constant(std::uint32_t index){return Val{index | constant_bit};}
+  bool is_null()const{return bits == ~0u;}
+  bool is_var()const{return !(bits & constant_bit);}
+  bool is_constant()const{return !is_null() && (bits & constant_bit);}
+  std::uint32_t index()const{return bits & ~constant_bit;}
+  bool operator==(Val other)const{return bits == other.bits;}
+  bool operator!=(Val other)const{return bits != other.bits;}
+};
+
+struct Inst{
+  Kind kind;
+  ast::OpType op{};
+  Val src_1{};
+  Val src_2{};
+  Val dst{};
+  std::uint32_t target{0};
+
+  static Inst ret(Val val){return {Kind::Ret, {}, val};}
+  static Inst unary(ast::OpType op, Val src, Val dst){return {Kind::Unary, op, src, {}, dst};}
+  static Inst binary(ast::OpType op, Val src_1, Val src_2, Val dst){
+    return {Kind::Binary, op, src_1, src_2, dst};
+  }
+  static Inst label(std::uint32_t number){return {Kind::Label, {}, {}, {}, {}, number};}
+  static Inst jmp(std::uint32_t label){return {Kind::Jmp, {}, {}, {}, {}, label};}
+  static Inst jnz(std::uint32_t label, Val cond){return {Kind::Jnz, {}, cond, {}, {}, label};}
+  static Inst jz(std::uint32_t label, Val cond){return {Kind::Jz, {}, cond, {}, {}, label};}
+  static Inst copy(Val src, Val dst){return {Kind::Copy, {}, src, {}, dst};}
+  static Inst call(std::uint32_t call, Val dst){return {Kind::Call, {}, {}, {}, dst, call};}
+  static Inst jump_table(std::uint32_t table, Val index){
+    return {Kind::JumpTable, {}, index, {}, {}, table};
+  }
 };
 
-struct FunctionDef: Base{
+// Arguments are args[first_arg, first_arg + arg_count) of the function.
+struct CallSite{
   char const* name;
   unsigned name_len;
-  Ptr<Inst> instructions;
-  FunctionDef(char const* name, unsigned name_len, Ptr<Inst> instructions)
-  :name(name), name_len(name_len), instructions(instructions){};
-  void print();
-};
-
-struct Inst: Base{
-  Ptr<Inst> next;
-  virtual ~Inst() = default;
-  Inst(Ptr<Inst> next){
-    assert(next.get() != this);
-    this->next = next;
+  std::uint32_t first_arg;
+  std::uint32_t arg_count;
+};
+
+// Indirect jump to the label at targets[first_target + index]; the index
+// has been checked to be in range. label names the table itself.
+struct JumpTable{
+  std::uint32_t label;
+  std::uint32_t first_target;
+  std::uint32_t target_count;
+};
+
+struct FunctionDef{
+  char const* name{0};
+  unsigned name_len{0};
+  std::vector<Inst> insts{};
+  std::vector<std::int64_t> constants{};
+  std::vector<Val> args{};
+  std::vector<CallSite> calls{};
+  std::vector<std::uint32_t> targets{};
+  std::vector<JumpTable> tables{};
+  // Parameters arrive in the first Vars.
+  unsigned param_count{0};
+  // Vars are numbered below tmp_count.
+  unsigned tmp_count{0};
+  // Labels are numbered from zero in each function; code generation
+  // offsets them to make them unique in the file.
+  unsigned label_count{0};
+
+  std::int64_t value(Val val)const{return constants[val.index()];}
+  Val add_constant(std::int64_t value){
+    constants.push_back(value);
+    return Val::constant(constants.size() - 1);
   }
-  virtual void print() = 0;
-};
-
-struct Ret: Inst{
-  Ptr<Val> val;
-  Ret(Ptr<Val> val, Ptr<Inst> next=0): Inst(next), val(val){};
-  void print()override;
-};
-
-struct Val: Base{
-  virtual ~Val() = default;
-  virtual std::string print() = 0;
-};
-
-struct Unary: Inst{
-  ast::OpType op;
-  Ptr<Val> src;
-  Ptr<Val> dst;
-  Unary(ast::OpType op, Ptr<Val> src, Ptr<Val> dst, Ptr<Inst> next=0):
-  Inst(next), op(op), src(src), dst(dst){}
-  void print()override;
-};
-
-struct Binary: Inst{
-  ast::OpType op;
-  Ptr<Val> src_1;
-  Ptr<Val> src_2;
-  Ptr<Val> dst; 
-  Binary(ast::OpType op, 
-    Ptr<Val> src_1,
-    Ptr<Val> src_2,
-    Ptr<Val> dst,
-    Ptr<Inst> next=0):Inst(next), op(op), src_1(src_1), src_2(src_2), dst(dst){}
-  void print()override;
+  Val new_tmp(){return Val::var(tmp_count++);}
+  // Write one instruction as one line.
+  void dump(utils::Sink& out, Inst const& inst)const;
+  void dump(utils::Sink& out)const;
 };
 
-struct Label: Inst{
-  unsigned number;
-  Label(unsigned number, Ptr<Inst> next=0): Inst(next), number(number){};
-  void print()override;
-};
-
-struct Jmp: Inst{
-  unsigned label;
-  Jmp(unsigned label, Ptr<Inst> next=0): Inst(next), label(label){};
-  void print()override;
-};
-
-struct Jnz: Inst{
-  unsigned label;
-  Ptr<Val> cond;
-  Jnz(unsigned label, Ptr<Val> cond, Ptr<Inst> next=0):Inst(next), label(label), cond(cond){};
-  void print()override;
-};
-
-struct Jz: Inst{
-  unsigned label;
-  Ptr<Val> cond;
-  Jz(unsigned label, Ptr<Val> cond, Ptr<Inst> next=0):Inst(next), label(label), cond(cond){};
-  void print()override;
-};
-
-struct Copy: Inst{
-  Ptr<Val> src;
-  Ptr<Val> dst;
-  Copy(Ptr<Val> src, Ptr<Val> dst, Ptr<Inst> next=0): Inst(next), src(src), dst(dst){};
-  void print()override;
-};
-
-struct Var: Val{
-  unsigned number;
-  Var(unsigned number): number(number){};
-  std::string print()override;
-};
-
-struct Constant: Val{
-  char const* val;
-  unsigned val_len;
-  Constant(char const* val, unsigned val_len): val(val), val_len(val_len){}
-  std::string print()override;
+struct Program{
+  std::vector<FunctionDef> funcdefs;
+  void dump(utils::Sink& out)const;
 };
 
 class AstBuilder{
-  unsigned tmp_val{0};
-  std::unordered_map<Ptr<std::string>, unsigned> var_tmp_map{};
-  std::unordered_map<Ptr<std::string>, unsigned> label_map{};
-  // for tmp var
-  unsigned get_tmp_val(){
-    return tmp_val++;
-  }
-
-  // for named var
-  unsigned get_tmp_val(Ptr<std::string> name){
-    if(var_tmp_map.count(name)) return var_tmp_map[name];
-    var_tmp_map[name] = tmp_val;
-    return tmp_val++;
+  // The function being built. Named variables keep their frame slot as
+  // their number; temporaries are numbered after them.
+  FunctionDef fn{};
+  // TACKY label of each user label number in the function.
+  std::unordered_map<std::uint32_t, unsigned> label_map{};
+  Val get_tmp_val(){
+    return fn.new_tmp();
   }
+  // Each value gets one entry in the constant pool.
+  std::unordered_map<std::int64_t, std::uint32_t> constant_index{};
+  Val get_constant(std::int64_t value);
 
   unsigned label_number{0};
   unsigned get_label(){
     return label_number++;
   }
-  unsigned get_label(Ptr<std::string> label_name){
-    if(label_map.count(label_name)) return label_map[label_name];
-    auto label = get_label();
-    label_map[label_name] = label;
-    return label;
+  unsigned get_label(ast::UserLabel const& user){
+    auto [it, inserted] = label_map.try_emplace(user.number);
+    if(inserted) it->second = get_label();
+    return it->second;
+  }
+
+  void append_cur_insts(Inst inst){
+    fn.insts.push_back(inst);
   }
 
-  Ptr<Inst> cur_insts{0};
-  Ptr<Inst> cur_insts_tail{0};
-  void append_cur_insts(Ptr<Inst>);
+  // Innermost targets of break and continue. A switch only takes break,
+  // passing on the continue target of the loop around it.
+  struct Jumps{
+    unsigned break_label;
+    unsigned continue_label;
+  };
+  std::vector<Jumps> jumps{};
+  // Label of every case of the switches in the function.
+  std::unordered_map<ast::CaseStmt*, unsigned> case_labels{};
+
+  struct SwitchCase{
+    std::int64_t value;
+    unsigned label;
+  };
+  // Branch on cond to the label of a case in [first, last), sorted by
+  // value, or to default_label.
+  void build_dispatch(Val cond, SwitchCase const* first, SwitchCase const* last,
+    unsigned default_label);
+  // Lower an else-if chain of equality tests of one variable like a
+  // switch; false if node does not start a long enough chain.
+  bool build_if_chain(ast::IfStmt*);
 
-  Ptr<Var> build_logic_and(Ptr<ast::Binary>);
-  Ptr<Var> build_logic_or(Ptr<ast::Binary>);
 public:
-  Ptr<Program> build(Ptr<ast::BaseNode>);
-  Ptr<Program> build(Ptr<ast::Program>);
-  Ptr<FunctionDef> build(Ptr<ast::FunctionDef>);
-  void build(Ptr<ast::Block>);
-  void build(Ptr<ast::Decl>);
-  void build(Ptr<ast::Stmt>);
-  void build(Ptr<ast::RetStmt>);
-  void build(Ptr<ast::CompoundStmt>);
-  void build(Ptr<ast::IfStmt>);
-  void build(Ptr<ast::ExprStmt>);
-  void build(Ptr<ast::GotoStmt>);
-  Ptr<Val> build(Ptr<ast::Expr>);
-  Ptr<Var> build(Ptr<ast::Unary>);
-  Ptr<Var> build(Ptr<ast::Binary>);
-  Ptr<Val> build(Ptr<ast::Assign>);
-  Ptr<Var> build(Ptr<ast::Condition>);
-  Ptr<Var> build(Ptr<ast::Var>);
-  Ptr<Constant> build(Ptr<ast::Constant>);
+  Ptr<Program> build(ast::BaseNode*);
+  Ptr<Program> build(ast::Program*);
+  FunctionDef build(ast::FunctionDef*);
+  void build(ast::Block*);
+  void build(ast::Decl*);
+  void build(ast::Stmt*);
+  void build(ast::RetStmt*);
+  void build(ast::CompoundStmt*);
+  void build(ast::IfStmt*);
+  void build(ast::WhileStmt*);
+  void build(ast::DoStmt*);
+  void build(ast::ForStmt*);
+  void build(ast::SwitchStmt*);
+  void build(ast::CaseStmt*);
+  void build(ast::ExprStmt*);
+  void build(ast::GotoStmt*);
+  Val build(ast::Expr*);
 };
 
 }
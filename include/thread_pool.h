@@ -0,0 +1,46 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace niubcc{
+
+class ThreadPool{
+private:
+  std::vector<std::thread> workers{};
+  std::queue<std::function<void()> > tasks{};
+  std::mutex mutex{};
+  std::condition_variable cond{};
+  bool stopping{false};
+
+  void work();
+
+public:
+  // A size of zero picks the number of hardware threads.
+  explicit ThreadPool(unsigned size=0);
+  ~ThreadPool();
+  ThreadPool(ThreadPool const&) = delete;
+  ThreadPool& operator=(ThreadPool const&) = delete;
+
+  unsigned size()const{return workers.size();}
+
+  template<class F, class R=std::invoke_result_t<std::decay_t<F> > >
+  std::future<R> submit(F&& f){
+    auto task = std::make_shared<std::packaged_task<R()> >(std::forward<F>(f));
+    auto future = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.emplace([task]{(*task)();});
+    }
+    cond.notify_one();
+    return future;
+  }
+};
+
+}
@@ -1,5 +1,9 @@
 #pragma once
+#include <charconv>
+#include <cstdio>
 #include <string>
+#include <string_view>
+#include <type_traits>
 
 namespace niubcc{
 namespace utils{
@@ -7,7 +11,56 @@ namespace utils{
     unsigned col;
     unsigned line;
   };
+  // printf-style, for cold paths such as error messages.
   std::string fmt(char const* fmt, ...);
   bool string_equal(char const*, char const*, unsigned);
+
+  // Hot paths build text with append(out, pieces...), which appends every
+  // piece in order: text as is, integers in decimal. Which conversion each
+  // piece needs is settled by overload resolution at compile time, and
+  // nothing is allocated beyond growing out.
+  inline void
+  append_one(std::string& out, std::string_view text){out += text;}
+  inline void
+  append_one(std::string& out, char c){out += c;}
+  template<class T, class=std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, char> && !std::is_same_v<T, bool> > >
+  inline void
+  append_one(std::string& out, T val){
+    char digits[24];
+    auto end = std::to_chars(digits, digits + sizeof(digits), val).ptr;
+    out.append(digits, end - digits);
+  }
+
+  template<class... Args>
+  void
+  append(std::string& out, Args const&... pieces){
+    (append_one(out, pieces), ...);
+  }
+
+  // Buffered text output for dumps. Without a file everything is kept in
+  // memory for take(); with one, the buffer is written out whenever it
+  // passes flush_size, so output of any size costs one buffer.
+  class Sink{
+    static constexpr std::size_t flush_size = 1 << 16;
+    std::FILE* file;
+    std::string buf{};
+
+    void wrote(){if(file && buf.size() >= flush_size) flush();}
+  public:
+    explicit Sink(std::FILE* file=0): file(file){};
+    Sink(Sink const&) = delete;
+    ~Sink(){flush();}
+
+    Sink& operator<<(std::string_view text){buf += text; wrote(); return *this;}
+    Sink& operator<<(char c){buf += c; wrote(); return *this;}
+    Sink& operator<<(long long val){append_one(buf, val); wrote(); return *this;}
+    Sink& operator<<(unsigned long long val){append_one(buf, val); wrote(); return *this;}
+    Sink& operator<<(int val){return *this << static_cast<long long>(val);}
+    Sink& operator<<(unsigned val){return *this << static_cast<unsigned long long>(val);}
+    Sink& tabs(unsigned count){buf.append(count, '\t'); wrote(); return *this;}
+
+    void flush();
+    std::string take(){return std::move(buf);}
+  };
 }
 }
\ No newline at end of file
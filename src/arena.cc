@@ -0,0 +1,26 @@
+#include "arena.h"
+#include <cstdlib>
+
+namespace niubcc{
+
+void
+Arena::grow(std::size_t size){
+  std::size_t capacity = size + sizeof(Chunk) > chunk_size ? size + sizeof(Chunk) : chunk_size;
+  auto chunk = static_cast<Chunk*>(std::malloc(capacity));
+  if(!chunk) throw std::bad_alloc();
+  chunk->prev = chunks;
+  chunks = chunk;
+  cur = reinterpret_cast<char*>(chunk + 1);
+  end = reinterpret_cast<char*>(chunk) + capacity;
+}
+
+Arena::~Arena(){
+  for(auto f = finalizers; f; f = f->prev) f->destroy(f->object);
+  while(chunks){
+    auto prev = chunks->prev;
+    std::free(chunks);
+    chunks = prev;
+  }
+}
+
+}
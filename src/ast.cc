@@ -1,288 +1,281 @@
 #include "ast.h"
-#include <cstdio>
+#include <algorithm>
+#include <vector>
 #include "utils.h"
 
 namespace niubcc{
 namespace ast{
 
-std::string
-Unary::print(unsigned depth=0){
-  auto indent = std::string(depth + 1, '\t');
-  auto end_indent = std::string(depth, '\t');
-  return utils::fmt(
-    "Unary(\n%soperator=%s\n%sexpr=%s\n%s)",
-    indent.c_str(),
-    map_op_name[static_cast<unsigned>(op_type)],
-    indent.c_str(),
-    expr->print(depth + 1).c_str(),
-    end_indent.c_str()
-  );
-}
-
-std::string
-Binary::print(unsigned depth=0){
-  auto indent = std::string(depth + 1, '\t');
-  auto end_indent = std::string(depth, '\t');
-  return utils::fmt(
-    "Binary(\n%soperator=%s\n%slhs=%s\n%srhs=%s\n%s)",
-    indent.c_str(),
-    map_op_name[static_cast<unsigned>(op_type)],
-    indent.c_str(),
-    lhs->print(depth + 1).c_str(),
-    indent.c_str(),
-    rhs->print(depth + 1).c_str(),
-    end_indent.c_str()
-  );
-}
-
-std::string
-Program::print(unsigned depth=0){
-  auto indent = std::string(depth + 1, '\t');
-  auto end_indent = std::string(depth, '\t');
-  return utils::fmt(
-    "Program(\n%s%s\n%s)",
-    indent.c_str(),
-    funcdef->print(depth + 1).c_str(),
-    end_indent.c_str()
-  );
-}
-
-std::string
-FunctionDef::print(unsigned depth=0){
-  auto indent = std::string(depth + 1, '\t');
-  auto end_indent = std::string(depth, '\t');
-  return utils::fmt(
-    "FunctionDef(\n%sname=%.*s\n%sbody=%s\n%s)",
-    indent.c_str(),
-    name_len, name,
-    indent.c_str(),
-    blocks->print(depth + 1).c_str(),
-    end_indent.c_str()
-  );
-}
-
-std::string
-CompoundStmt::print(unsigned depth=0){
-  auto label_name = label ? *label : "none";
-  auto indent = std::string(depth + 1, '\t');
-  auto end_indent = std::string(depth, '\t');
-  std::string res = utils::fmt(
-    "Stmts(label: %s\n%s[",
-    label_name.c_str(),
-    indent.c_str()
-  );
-  auto cur_block = blocks;
-  while(cur_block){
-    res += std::move(cur_block->print(depth + 1)); // explictly choose move assignment
-    cur_block = cur_block->next;
-  }
-  res += utils::fmt("%s]\n%s)", indent.c_str(), end_indent.c_str());
-  return res;
-}
-
-std::string
-RetStmt::print(unsigned depth=0){
-  auto label_name = label ? *label : "none";
-  auto indent = std::string(depth + 1, '\t');
-  auto end_indent = std::string(depth, '\t');
-  return utils::fmt(
-    "ReturnStmt(Label:%s\n%s%s\n%s)",
-    label_name.c_str(),
-    indent.c_str(),
-    ret_val->print(depth + 1).c_str(),
-    end_indent.c_str()
-  );
-}
-
-std::string
-IfStmt::print(unsigned depth=0){
-  auto label_name = label ? *label : "none";
-  auto indent = std::string(depth + 1, '\t');
-  auto end_indent = std::string(depth, '\t');
-
-  std::string else_repr{"none"};
-  if(else_stmt) else_repr = else_stmt->print(depth + 1);
-  return utils::fmt(
-    "IfStmt(Label: %s\n%scondition=%s\n%sthen=%s\n%selse=%s\n%s)",
-    label_name.c_str(),
-    indent.c_str(),
-    condition->print(depth + 1).c_str(),
-    indent.c_str(),
-    then_stmt->print(depth + 1).c_str(),
-    indent.c_str(),
-    else_repr.c_str(),
-    end_indent.c_str()
-  );
-}
-
-std::string
-GotoStmt::print(unsigned depth){
-  auto label_name = label ? *label : "none";
-  return utils::fmt("GotoStmt(Label: %s target: %s)", label_name.c_str(), target->c_str());
-}
-
-std::string
-Constant::print(unsigned depth=0){
-  return utils::fmt(
-    "Conatant(%.*s)",
-    value_len, value
-  );
-}
+namespace{
+// Pending work of the printer: either a node to print at some depth, or
+// the text that follows a child, written as pre, tabs, then post.
+struct Piece{
+  BaseNode* node{0};
+  unsigned depth{0};
+  char const* pre{0};
+  unsigned tabs{0};
+  char const* post{0};
+};
 
-std::string
-Condition::print(unsigned depth=0){
-  auto indent = std::string(depth + 1, '\t');
-  auto end_indent = std::string(depth, '\t');
-  return utils::fmt(
-    "Condition(\n%scondition=%s\n%strue=%s\n%sfalse=%s\n%s)",
-    indent.c_str(),
-    condition->print(depth + 1).c_str(),
-    indent.c_str(),
-    true_val->print(depth + 1).c_str(),
-    indent.c_str(),
-    false_val->print(depth + 1).c_str(),
-    end_indent.c_str()
-  );
-}
-
-std::string
-Var::print(unsigned depth=0){
-  return utils::fmt("Var(%s)", name->c_str());
-}
-
-std::string
-Assign::print(unsigned depth=0){
-  auto indent = std::string(depth + 1, '\t');
-  auto end_indent = std::string(depth, '\t');
-  return utils::fmt("Assign(\n%ssrc=%s\n%sdst=%s\n%s)",
-    indent.c_str(),
-    src->print(depth + 1).c_str(),
-    indent.c_str(),
-    dst->print(depth + 1).c_str(),
-    end_indent.c_str()
-  );
+std::string_view
+label_name(UserLabel const& label){
+  return label.name ? std::string_view(label.name, label.name_len) : "none";
 }
-
-std::string
-NullStmt::print(unsigned depth=0){
-  auto label_name = label ? *label : "none";
-  return utils::fmt("NullStmt(Label: %s)", label_name.c_str());
 }
 
 std::string
-ExprStmt::print(unsigned depth=0){
-  auto label_name = label ? *label : "none";
-  auto indent = std::string(depth + 1, '\t');
-  auto end_indent = std::string(depth, '\t');
-  return utils::fmt("ExprStmt(Label: %s\n%sexpr=%s\n%s)",
-    label_name.c_str(),
-    indent.c_str(),
-    expr->print(depth + 1).c_str(),
-    end_indent.c_str()
-  );
+BaseNode::print(unsigned depth){
+  utils::Sink out;
+  dump(out, depth);
+  return out.take();
 }
 
-std::string
-Decl::print(unsigned depth=0){
-  auto indent = std::string(depth + 1, '\t');
-  auto end_indent = std::string(depth, '\t');
-  std::string init_expr{"none"};
-  if(init) init_expr = init->print(depth + 1);
-  return utils::fmt("Declaration(\n%sname=%s\n%sinit=%s\n%s)",
-    indent.c_str(),
-    name->c_str(),
-    indent.c_str(),
-    init_expr.c_str(),
-    end_indent.c_str()
-  );
-}
+void
+BaseNode::dump(utils::Sink& out, unsigned depth){
+  std::vector<Piece> work{{this, depth}};
 
-std::string
-DoStmt::print(unsigned depth){
-  auto label_name = label ? *label : "none";
-  auto indent = std::string(depth + 1, '\t');
-  auto end_indent = std::string(depth, '\t');
-  return utils::fmt("Do(Label: %s\n%sstmts=%s\n%scondition=%s\n%s)",
-    label_name.c_str(),
-    indent.c_str(),
-    stmt->print(depth + 1).c_str(),
-    indent.c_str(),
-    condition->print(depth + 1).c_str(),
-    end_indent.c_str()
-  );
-}
+  auto put = [&out](char const* pre, unsigned tabs, std::string_view post){
+    out << pre;
+    out.tabs(tabs) << post;
+  };
+  // Pieces run last in first out, so push what follows a child before it.
+  auto then = [&work](char const* pre, unsigned tabs, char const* post){
+    work.push_back({0, 0, pre, tabs, post});
+  };
+  auto child = [&work](BaseNode* node, unsigned depth){
+    work.push_back({node, depth});
+  };
+  auto child_or_none = [&](BaseNode* node, unsigned depth){
+    if(node) child(node, depth);
+    else then("none", 0, "");
+  };
+  // Push a list of blocks so that they come off the stack in order.
+  auto children = [&work](Block* head, unsigned depth){
+    auto first = work.size();
+    for(auto cur = head; cur; cur = cur->next) work.push_back({cur, depth});
+    std::reverse(work.begin() + first, work.end());
+  };
 
-std::string
-WhileStmt::print(unsigned depth){
-  auto label_name = label ? *label : "none";
-  auto indent = std::string(depth + 1, '\t');
-  auto end_indent = std::string(depth, '\t');
-  return utils::fmt("While(Label: %s\n%sstmts=%s\n%scondition=%s\n%s)",
-    label_name.c_str(),
-    indent.c_str(),
-    stmt->print(depth + 1).c_str(),
-    indent.c_str(),
-    condition->print(depth + 1).c_str(),
-    end_indent.c_str()
-  );
-}
+  while(!work.empty()){
+    auto piece = work.back();
+    work.pop_back();
+    if(!piece.node){
+      put(piece.pre, piece.tabs, piece.post);
+      continue;
+    }
 
-std::string
-ForStmtInit::print(unsigned depth){
-  if(decls){
-    auto indent = std::string(depth + 1, '\t');
-    auto end_indent = std::string(depth, '\t');
-    std::string res = utils::fmt("Decls(\n%s[", indent.c_str());
-    auto cur = decls;
-    while(cur){
-      res += std::move(cur->print(depth + 1));
-      cur = std::dynamic_pointer_cast<Decl>(cur->next);
+    auto d = piece.depth;
+    switch(auto node = piece.node; node->kind){
+      case Kind::Program:{
+        auto& funcdefs = static_cast<Program*>(node)->funcdefs;
+        out << "Program(";
+        then("\n", d, ")");
+        for(auto it = funcdefs.rbegin(); it != funcdefs.rend(); ++it){
+          child(*it, d + 1);
+          then("\n", d + 1, "");
+        }
+        break;
+      }
+      case Kind::FunctionDef:{
+        auto p = static_cast<FunctionDef*>(node);
+        put("FunctionDef(\n", d + 1, "name=");
+        out << std::string_view(p->name, p->name_len);
+        if(!p->params.empty()){
+          put("\n", d + 1, "params=");
+          for(unsigned i = 0; i < p->params.size(); ++i){
+            auto param = p->params[i];
+            out << (i ? ", " : "") << std::string_view(param->name, param->name_len)
+                << '.' << param->slot;
+          }
+        }
+        put("\n", d + 1, "body=");
+        then("\n", d, ")");
+        child(p->blocks, d + 1);
+        break;
+      }
+      case Kind::Decl:{
+        auto p = static_cast<Decl*>(node);
+        put("Declaration(\n", d + 1, "name=");
+        out << std::string_view(p->name, p->name_len) << '.' << p->slot << '\n';
+        put("", d + 1, "init=");
+        then("\n", d, ")");
+        child_or_none(p->init, d + 1);
+        break;
+      }
+      case Kind::ForStmtInit:{
+        auto p = static_cast<ForStmtInit*>(node);
+        if(!p->decls){
+          child(p->expr, d + 1);
+          break;
+        }
+        put("Decls(\n", d + 1, "[");
+        then("\n", d, ")");
+        then("", d + 1, "]");
+        children(p->decls, d + 1);
+        break;
+      }
+      case Kind::RetStmt:
+        put("ReturnStmt(Label:", 0, label_name(static_cast<Stmt*>(node)->label));
+        put("\n", d + 1, "");
+        then("\n", d, ")");
+        child(static_cast<RetStmt*>(node)->ret_val, d + 1);
+        break;
+      case Kind::NullStmt:
+        put("NullStmt(Label: ", 0, label_name(static_cast<Stmt*>(node)->label));
+        out << ')';
+        break;
+      case Kind::ExprStmt:
+        put("ExprStmt(Label: ", 0, label_name(static_cast<Stmt*>(node)->label));
+        put("\n", d + 1, "expr=");
+        then("\n", d, ")");
+        child(static_cast<ExprStmt*>(node)->expr, d + 1);
+        break;
+      case Kind::IfStmt:{
+        auto p = static_cast<IfStmt*>(node);
+        put("IfStmt(Label: ", 0, label_name(p->label));
+        put("\n", d + 1, "condition=");
+        then("\n", d, ")");
+        child_or_none(p->else_stmt, d + 1);
+        then("\n", d + 1, "else=");
+        child(p->then_stmt, d + 1);
+        then("\n", d + 1, "then=");
+        child(p->condition, d + 1);
+        break;
+      }
+      case Kind::DoStmt:
+      case Kind::WhileStmt:{
+        bool is_do = node->kind == Kind::DoStmt;
+        auto p = static_cast<Stmt*>(node);
+        auto stmt = is_do ? static_cast<DoStmt*>(p)->stmt : static_cast<WhileStmt*>(p)->stmt;
+        auto condition = is_do ? static_cast<DoStmt*>(p)->condition
+                               : static_cast<WhileStmt*>(p)->condition;
+        put(is_do ? "Do(Label: " : "While(Label: ", 0, label_name(p->label));
+        put("\n", d + 1, "stmts=");
+        then("\n", d, ")");
+        child(condition, d + 1);
+        then("\n", d + 1, "condition=");
+        child(stmt, d + 1);
+        break;
+      }
+      case Kind::ForStmt:{
+        auto p = static_cast<ForStmt*>(node);
+        put("For(Label: ", 0, label_name(p->label));
+        put("\n", d + 1, "init=");
+        then("\n", d, ")");
+        child(p->stmt, d + 1);
+        then("\n", d + 1, "stmt=");
+        child_or_none(p->post, d + 1);
+        then("\n", d + 1, "post=");
+        child_or_none(p->condition, d + 1);
+        then("\n", d + 1, "condition=");
+        child_or_none(p->init, d + 1);
+        break;
+      }
+      case Kind::Break:
+        put("Break(Label: ", 0, label_name(static_cast<Stmt*>(node)->label));
+        out << ")\n";
+        break;
+      case Kind::Continue:
+        put("Continue(Label: ", 0, label_name(static_cast<Stmt*>(node)->label));
+        out << ")\n";
+        break;
+      case Kind::GotoStmt:{
+        auto p = static_cast<GotoStmt*>(node);
+        out << "GotoStmt(Label: " << label_name(p->label) << " target: " << label_name(p->target) << ')';
+        break;
+      }
+      case Kind::CompoundStmt:{
+        auto p = static_cast<CompoundStmt*>(node);
+        put("Stmts(label: ", 0, label_name(p->label));
+        put("\n", d + 1, "[");
+        then("\n", d, ")");
+        then("", d + 1, "]");
+        children(p->blocks, d + 1);
+        break;
+      }
+      case Kind::SwitchStmt:{
+        auto p = static_cast<SwitchStmt*>(node);
+        put("Switch(Label: ", 0, label_name(p->label));
+        put("\n", d + 1, "condition=");
+        then("\n", d, ")");
+        child(p->body, d + 1);
+        then("\n", d + 1, "body=");
+        child(p->condition, d + 1);
+        break;
+      }
+      case Kind::CaseStmt:{
+        auto p = static_cast<CaseStmt*>(node);
+        put(p->is_default ? "Default(Label: " : "Case(Label: ", 0, label_name(p->label));
+        if(!p->is_default) out << " value=" << static_cast<long long>(p->value);
+        put("\n", d + 1, "stmt=");
+        then("\n", d, ")");
+        child(p->stmt, d + 1);
+        break;
+      }
+      case Kind::Unary:{
+        auto p = static_cast<Unary*>(node);
+        put("Unary(\n", d + 1, "operator=");
+        out << map_op_name[static_cast<unsigned>(p->op_type)];
+        put("\n", d + 1, "expr=");
+        then("\n", d, ")");
+        child(p->expr, d + 1);
+        break;
+      }
+      case Kind::Binary:{
+        auto p = static_cast<Binary*>(node);
+        put("Binary(\n", d + 1, "operator=");
+        out << map_op_name[static_cast<unsigned>(p->op_type)];
+        put("\n", d + 1, "lhs=");
+        then("\n", d, ")");
+        child(p->rhs, d + 1);
+        then("\n", d + 1, "rhs=");
+        child(p->lhs, d + 1);
+        break;
+      }
+      case Kind::Var:{
+        auto p = static_cast<Var*>(node);
+        out << "Var(" << std::string_view(p->name, p->name_len) << '.' << p->slot << ')';
+        break;
+      }
+      case Kind::Assign:{
+        auto p = static_cast<Assign*>(node);
+        put("Assign(\n", d + 1, "src=");
+        then("\n", d, ")");
+        child(p->dst, d + 1);
+        then("\n", d + 1, "dst=");
+        child(p->src, d + 1);
+        break;
+      }
+      case Kind::Constant:
+        out << "Conatant(" << static_cast<long long>(static_cast<Constant*>(node)->value) << ')';
+        break;
+      case Kind::Call:{
+        auto p = static_cast<Call*>(node);
+        put("Call(\n", d + 1, "name=");
+        out << std::string_view(p->name, p->name_len);
+        put("\n", d + 1, "args=[");
+        then("\n", d, ")");
+        then("\n", d + 1, "]");
+        for(auto it = p->args.rbegin(); it != p->args.rend(); ++it){
+          child(*it, d + 2);
+          then("\n", d + 2, "");
+        }
+        break;
+      }
+      case Kind::Condition:{
+        auto p = static_cast<Condition*>(node);
+        put("Condition(\n", d + 1, "condition=");
+        then("\n", d, ")");
+        child(p->false_val, d + 1);
+        then("\n", d + 1, "false=");
+        child(p->true_val, d + 1);
+        then("\n", d + 1, "true=");
+        child(p->condition, d + 1);
+        break;
+      }
     }
-    res += utils::fmt("%s]\n%s)", indent.c_str(), end_indent.c_str());
-    return res;
   }
-
-  return expr->print(depth + 1);
-}
-
-std::string
-ForStmt::print(unsigned depth){
-  auto label_name = label ? *label : "none";
-  auto indent = std::string(depth + 1, '\t');
-  auto end_indent = std::string(depth, '\t');
-
-  std::string init_repr{"none"};
-  std::string cond_repr{"none"};
-  std::string post_repr{"none"};
-  if(init) init_repr = init->print(depth + 1);
-  if(condition) cond_repr = condition->print(depth + 1);
-  if(post) post_repr = post->print(depth + 1);
-
-  return utils::fmt("For(Label: %s\n%sinit=%s\n%scondition=%s\n%spost=%s\n%sstmt=%s\n%s)",
-    label_name.c_str(),
-    indent.c_str(),
-    init_repr.c_str(),
-    indent.c_str(),
-    cond_repr.c_str(),
-    indent.c_str(),
-    post_repr.c_str(),
-    indent.c_str(),
-    stmt->print(depth + 1).c_str(),
-    end_indent.c_str()
-  );
 }
 
-std::string
-Break::print(unsigned depth){
-  auto label_name = label ? *label : "none";
-  return utils::fmt("Break(Label: %s)\n", label_name.c_str());
 }
-
-std::string
-Continue::print(unsigned depth){
-  auto label_name = label ? *label : "none";
-  return utils::fmt("Continue(Label: %s)\n", label_name.c_str());
-}
-
 }
-}
\ No newline at end of file
@@ -0,0 +1,384 @@
+#include "baseline.h"
+#include "codegen.h"
+#include "utils.h"
+#include <cassert>
+
+namespace niubcc{
+namespace codegen{
+
+namespace{
+// System V integer argument registers.
+char const* const arg_regs_32[] = {"%edi", "%esi", "%edx", "%ecx", "%r8d", "%r9d"};
+char const* const arg_regs_64[] = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
+constexpr unsigned arg_reg_count = 6;
+
+Operand
+slot(std::uint32_t slot){
+  return Operand(OperandType::Mem, std::int64_t{(slot + 1) * 4});
+}
+}
+
+unsigned
+BaselineGenerator::user_label(ast::UserLabel const& label){
+  auto [it, inserted] = user_labels.try_emplace(label.number);
+  if(inserted) it->second = new_label();
+  return it->second;
+}
+
+void
+BaselineGenerator::generate(ast::Program* node){
+  for(auto funcdef: node->funcdefs)
+    generate(funcdef);
+  emit(".section .note.GNU-stack,\"\",@progbits\n");
+}
+
+void
+BaselineGenerator::generate(ast::FunctionDef* node){
+  user_labels.clear();
+  std::string_view name(node->name, node->name_len);
+  auto frame_size = (node->var_count * 4 + 15) & ~15u;
+  emit("\t.globl ", name, '\n', name, ":\n",
+    "pushq\t%rbp\n", "movq\t%rsp, %rbp\n", "subq\t$", frame_size, ", %rsp\n");
+  for(unsigned i = 0; i < node->params.size(); ++i){
+    if(i < arg_reg_count)
+      emit("movl\t", arg_regs_32[i], ", ", slot(i), '\n');
+    else
+      emit("movl\t", 16 + 8 * (i - arg_reg_count), "(%rbp), %eax\n", "movl\t%eax, ", slot(i), '\n');
+  }
+  generate(node->blocks);
+  // Falling off the end returns 0, as main must.
+  emit("movl\t$0, %eax\n");
+  emit_epilogue();
+}
+
+void
+BaselineGenerator::generate(ast::Block* node){
+  if(node->kind != ast::Kind::Decl){
+    generate(static_cast<ast::Stmt*>(node));
+    return;
+  }
+  auto decl = static_cast<ast::Decl*>(node);
+  if(!decl->init) return;
+  generate(decl->init);
+  emit("movl\t%eax, ", slot(decl->slot), '\n');
+}
+
+void
+BaselineGenerator::generate(ast::ForStmtInit* node){
+  for(ast::Block* decl = node->decls; decl; decl = decl->next)
+    generate(decl);
+  if(node->expr) generate(node->expr);
+}
+
+void
+BaselineGenerator::generate_jz(ast::Expr* node, unsigned label){
+  generate(node);
+  emit("cmpl\t$0, %eax\n", "je\t.L", label, '\n');
+}
+
+void
+BaselineGenerator::generate(ast::Stmt* node){
+  if(node->label.name) emit_label(user_label(node->label));
+
+  switch(node->kind){
+    case ast::Kind::RetStmt:
+      generate(static_cast<ast::RetStmt*>(node)->ret_val);
+      emit_epilogue();
+      break;
+    case ast::Kind::ExprStmt:
+      generate(static_cast<ast::ExprStmt*>(node)->expr);
+      break;
+    case ast::Kind::IfStmt:{
+      auto p = static_cast<ast::IfStmt*>(node);
+      auto else_label = new_label();
+      generate_jz(p->condition, else_label);
+      generate(p->then_stmt);
+      if(!p->else_stmt){
+        emit_label(else_label);
+        break;
+      }
+      auto end_label = new_label();
+      emit("jmp\t.L", end_label, '\n');
+      emit_label(else_label);
+      generate(p->else_stmt);
+      emit_label(end_label);
+      break;
+    }
+    case ast::Kind::WhileStmt:{
+      auto p = static_cast<ast::WhileStmt*>(node);
+      Loop loop{new_label(), new_label()};
+      emit_label(loop.continue_label);
+      generate_jz(p->condition, loop.break_label);
+      loops.push_back(loop);
+      generate(p->stmt);
+      loops.pop_back();
+      emit("jmp\t.L", loop.continue_label, '\n');
+      emit_label(loop.break_label);
+      break;
+    }
+    case ast::Kind::DoStmt:{
+      auto p = static_cast<ast::DoStmt*>(node);
+      auto start_label = new_label();
+      Loop loop{new_label(), new_label()};
+      emit_label(start_label);
+      loops.push_back(loop);
+      generate(p->stmt);
+      loops.pop_back();
+      emit_label(loop.continue_label);
+      generate(p->condition);
+      emit("cmpl\t$0, %eax\n", "jne\t.L", start_label, '\n');
+      emit_label(loop.break_label);
+      break;
+    }
+    case ast::Kind::ForStmt:{
+      auto p = static_cast<ast::ForStmt*>(node);
+      if(p->init) generate(p->init);
+      auto start_label = new_label();
+      Loop loop{new_label(), new_label()};
+      emit_label(start_label);
+      if(p->condition) generate_jz(p->condition, loop.break_label);
+      loops.push_back(loop);
+      generate(p->stmt);
+      loops.pop_back();
+      emit_label(loop.continue_label);
+      if(p->post) generate(p->post);
+      emit("jmp\t.L", start_label, '\n');
+      emit_label(loop.break_label);
+      break;
+    }
+    case ast::Kind::SwitchStmt:{
+      // Compare against the cases in source order.
+      auto p = static_cast<ast::SwitchStmt*>(node);
+      generate(p->condition);
+      auto case_base = label_count;
+      label_count += p->cases.size();
+      Loop loop{loops.empty() ? 0 : loops.back().continue_label, new_label()};
+      auto default_label = loop.break_label;
+      for(auto c: p->cases){
+        if(c->is_default) default_label = case_base + c->index;
+        else emit("cmpl\t$", c->value, ", %eax\n", "je\t.L", case_base + c->index, '\n');
+      }
+      emit("jmp\t.L", default_label, '\n');
+      loops.push_back(loop);
+      case_bases.push_back(case_base);
+      generate(p->body);
+      case_bases.pop_back();
+      loops.pop_back();
+      emit_label(loop.break_label);
+      break;
+    }
+    case ast::Kind::CaseStmt:{
+      auto p = static_cast<ast::CaseStmt*>(node);
+      emit_label(case_bases.back() + p->index);
+      generate(p->stmt);
+      break;
+    }
+    case ast::Kind::Break:
+      emit("jmp\t.L", loops.back().break_label, '\n');
+      break;
+    case ast::Kind::Continue:
+      emit("jmp\t.L", loops.back().continue_label, '\n');
+      break;
+    case ast::Kind::GotoStmt:
+      emit("jmp\t.L", user_label(static_cast<ast::GotoStmt*>(node)->target), '\n');
+      break;
+    case ast::Kind::CompoundStmt:
+      for(auto cur = static_cast<ast::CompoundStmt*>(node)->blocks; cur; cur = cur->next)
+        generate(cur);
+      break;
+    default: break;
+  }
+}
+
+// Like AstBuilder, expressions are walked with an explicit stack; a frame
+// is revisited after each operand, whose value is then in %eax.
+void
+BaselineGenerator::generate(ast::Expr* root){
+  struct Frame{
+    ast::Expr* node{0};
+    unsigned stage{0};
+    unsigned label{0};
+  };
+  std::vector<Frame> frames{{root}};
+  auto visit = [&frames](ast::Expr* node){frames.push_back({node});};
+  auto push = [this]{
+    emit("pushq\t%rax\n");
+    ++pushed;
+  };
+  // The right operand goes to %ecx and the pushed left one back to %eax.
+  auto pop_lhs = [this]{
+    emit("movl\t%eax, %ecx\n", "popq\t%rax\n");
+    --pushed;
+  };
+
+  while(!frames.empty()){
+    auto& frame = frames.back();
+    switch(auto node = frame.node; node->kind){
+      case ast::Kind::Constant:
+        emit("movl\t$", static_cast<ast::Constant*>(node)->value, ", %eax\n");
+        frames.pop_back();
+        break;
+
+      case ast::Kind::Var:
+        emit("movl\t", slot(static_cast<ast::Var*>(node)->slot), ", %eax\n");
+        frames.pop_back();
+        break;
+
+      case ast::Kind::Unary:{
+        auto p = static_cast<ast::Unary*>(node);
+        if(frame.stage++ == 0){
+          visit(p->expr);
+          break;
+        }
+        switch(p->op_type){
+          case ast::OpType::op_minus: emit("negl\t%eax\n"); break;
+          case ast::OpType::op_bitnot: emit("notl\t%eax\n"); break;
+          default: emit("cmpl\t$0, %eax\n", "movl\t$0, %eax\n", "sete\t%al\n"); break;
+        }
+        frames.pop_back();
+        break;
+      }
+
+      case ast::Kind::Assign:{
+        auto p = static_cast<ast::Assign*>(node);
+        if(frame.stage++ == 0){
+          visit(p->src);
+          break;
+        }
+        emit("movl\t%eax, ", slot(static_cast<ast::Var*>(p->dst)->slot), '\n');
+        frames.pop_back();
+        break;
+      }
+
+      case ast::Kind::Condition:{
+        // label: false, label + 1: end
+        auto p = static_cast<ast::Condition*>(node);
+        switch(frame.stage++){
+          case 0:
+            visit(p->condition);
+            break;
+          case 1:
+            frame.label = new_label();
+            new_label();
+            emit("cmpl\t$0, %eax\n", "je\t.L", frame.label, '\n');
+            visit(p->true_val);
+            break;
+          case 2:
+            emit("jmp\t.L", frame.label + 1, '\n');
+            emit_label(frame.label);
+            visit(p->false_val);
+            break;
+          default:
+            emit_label(frame.label + 1);
+            frames.pop_back();
+        }
+        break;
+      }
+
+      case ast::Kind::Binary:{
+        auto p = static_cast<ast::Binary*>(node);
+        if(p->op_type == ast::OpType::op_and || p->op_type == ast::OpType::op_or){
+          // label: short circuit, label + 1: end
+          bool is_and = p->op_type == ast::OpType::op_and;
+          switch(frame.stage++){
+            case 0:
+              visit(p->lhs);
+              break;
+            case 1:
+              frame.label = new_label();
+              new_label();
+              emit("cmpl\t$0, %eax\n", is_and ? "je\t.L" : "jne\t.L", frame.label, '\n');
+              visit(p->rhs);
+              break;
+            default:
+              emit("cmpl\t$0, %eax\n", "movl\t$0, %eax\n", "setne\t%al\n",
+                "jmp\t.L", frame.label + 1, '\n');
+              emit_label(frame.label);
+              emit("movl\t$", is_and ? 0 : 1, ", %eax\n");
+              emit_label(frame.label + 1);
+              frames.pop_back();
+          }
+          break;
+        }
+
+        switch(frame.stage++){
+          case 0:
+            visit(p->lhs);
+            break;
+          case 1:
+            push();
+            visit(p->rhs);
+            break;
+          default:{
+            pop_lhs();
+            char const* set = 0;
+            switch(p->op_type){
+              case ast::OpType::op_plus: emit("addl\t%ecx, %eax\n"); break;
+              case ast::OpType::op_minus: emit("subl\t%ecx, %eax\n"); break;
+              case ast::OpType::op_asterisk: emit("imull\t%ecx, %eax\n"); break;
+              case ast::OpType::op_slash: emit("cdq\n", "idivl\t%ecx\n"); break;
+              case ast::OpType::op_percent: emit("cdq\n", "idivl\t%ecx\n", "movl\t%edx, %eax\n"); break;
+              case ast::OpType::op_bitand: emit("andl\t%ecx, %eax\n"); break;
+              case ast::OpType::op_bitor: emit("orl\t%ecx, %eax\n"); break;
+              case ast::OpType::op_bitxor: emit("xorl\t%ecx, %eax\n"); break;
+              case ast::OpType::op_lshift: emit("shll\t%cl, %eax\n"); break;
+              case ast::OpType::op_rshift: emit("sarl\t%cl, %eax\n"); break;
+              case ast::OpType::op_eq: set = "sete"; break;
+              case ast::OpType::op_ne: set = "setne"; break;
+              case ast::OpType::op_lt: set = "setl"; break;
+              case ast::OpType::op_le: set = "setle"; break;
+              case ast::OpType::op_gt: set = "setg"; break;
+              case ast::OpType::op_ge: set = "setge"; break;
+              default: assert(0 && "unreachable");
+            }
+            if(set) emit("cmpl\t%ecx, %eax\n", "movl\t$0, %eax\n", set, "\t%al\n");
+            frames.pop_back();
+          }
+        }
+        break;
+      }
+
+      case ast::Kind::Call:{
+        // Arguments are pushed right to left, then the first ones popped
+        // into registers, which leaves the rest in place for the call.
+        // label: whether %rsp was padded to keep it 16-byte aligned.
+        auto p = static_cast<ast::Call*>(node);
+        unsigned arg_count = p->args.size();
+        unsigned stack_args = arg_count > arg_reg_count ? arg_count - arg_reg_count : 0;
+        auto stage = frame.stage++;
+        if(stage == 0){
+          frame.label = (pushed + stack_args) % 2;
+          if(frame.label){
+            emit("subq\t$8, %rsp\n");
+            ++pushed;
+          }
+        }else push();
+        if(stage < arg_count){
+          visit(p->args[arg_count - 1 - stage]);
+          break;
+        }
+
+        unsigned reg_args = arg_count - stack_args;
+        for(unsigned i = 0; i < reg_args; ++i)
+          emit("popq\t", arg_regs_64[i], '\n');
+        emit("call\t", std::string_view(p->name, p->name_len), '\n');
+        unsigned words = stack_args + frame.label;
+        if(words) emit("addq\t$", words * 8, ", %rsp\n");
+        pushed -= reg_args + words;
+        frames.pop_back();
+        break;
+      }
+
+      default:
+        assert(0 && "unreachable");
+    }
+  }
+}
+
+void
+BaselineGenerator::emie_code(char const* filename)const{
+  write_code(code, filename);
+}
+
+}
+}
@@ -0,0 +1,196 @@
+#include "cfg.h"
+#include <algorithm>
+
+namespace niubcc{
+namespace ir{
+
+namespace{
+bool
+ends_block(Inst const& inst){
+  switch(inst.kind){
+    case Kind::Ret:
+    case Kind::Jmp:
+    case Kind::Jnz:
+    case Kind::Jz:
+    case Kind::JumpTable:
+      return true;
+    default:
+      return false;
+  }
+}
+}
+
+// A block starts at the first instruction, after each jump or return,
+// and at each run of labels.
+Cfg
+Cfg::build(FunctionDef const& fn){
+  Cfg cfg;
+  cfg.blocks.emplace_back();
+  for(auto& inst: fn.insts){
+    auto& cur = cfg.blocks.back().insts;
+    if(!cur.empty() && (ends_block(cur.back())
+      || (inst.kind == Kind::Label && cur.back().kind != Kind::Label)))
+      cfg.blocks.emplace_back();
+    cfg.blocks.back().insts.push_back(inst);
+  }
+  cfg.analyze(fn);
+  return cfg;
+}
+
+void
+Cfg::analyze(FunctionDef const& fn){
+  label_blocks.assign(fn.label_count, none);
+  for(std::uint32_t i = 0; i < blocks.size(); ++i)
+    for(auto& inst: blocks[i].insts){
+      if(inst.kind != Kind::Label) break;
+      label_blocks[inst.target] = i;
+    }
+  link(fn);
+  order();
+  compute_dominators();
+}
+
+bool
+Cfg::falls_through(BasicBlock const& block){
+  if(block.insts.empty()) return true;
+  auto kind = block.insts.back().kind;
+  return kind != Kind::Jmp && kind != Kind::Ret && kind != Kind::JumpTable;
+}
+
+void
+Cfg::link(FunctionDef const& fn){
+  for(auto& block: blocks){
+    block.succs.clear();
+    block.preds.clear();
+  }
+  for(std::uint32_t i = 0; i < blocks.size(); ++i){
+    auto& block = blocks[i];
+    auto add = [&block](std::uint32_t succ){
+      if(std::find(block.succs.begin(), block.succs.end(), succ) == block.succs.end())
+        block.succs.push_back(succ);
+    };
+    if(!block.insts.empty()){
+      auto& last = block.insts.back();
+      switch(last.kind){
+        case Kind::Jmp:
+        case Kind::Jnz:
+        case Kind::Jz:
+          add(label_blocks[last.target]);
+          break;
+        case Kind::JumpTable:{
+          auto& table = fn.tables[last.target];
+          for(std::uint32_t t = 0; t < table.target_count; ++t)
+            add(label_blocks[fn.targets[table.first_target + t]]);
+          break;
+        }
+        default: break;
+      }
+    }
+    if(falls_through(block) && i + 1 < blocks.size()) add(i + 1);
+  }
+  for(std::uint32_t i = 0; i < blocks.size(); ++i)
+    for(auto succ: blocks[i].succs)
+      blocks[succ].preds.push_back(i);
+}
+
+// Depth-first from the entry with an explicit stack; a frame holds the
+// block and how many of its successors have been visited.
+void
+Cfg::order(){
+  for(auto& block: blocks) block.rpo_index = none;
+  rpo.clear();
+  std::vector<std::pair<std::uint32_t, std::uint32_t> > stack{{0, 0}};
+  std::vector<bool> seen(blocks.size());
+  seen[0] = true;
+  while(!stack.empty()){
+    auto& [block, next] = stack.back();
+    auto& succs = blocks[block].succs;
+    if(next < succs.size()){
+      auto succ = succs[next++];
+      if(!seen[succ]){
+        seen[succ] = true;
+        stack.push_back({succ, 0});
+      }
+      continue;
+    }
+    rpo.push_back(block);
+    stack.pop_back();
+  }
+  std::reverse(rpo.begin(), rpo.end());
+  for(std::uint32_t i = 0; i < rpo.size(); ++i)
+    blocks[rpo[i]].rpo_index = i;
+}
+
+// Cooper, Harvey and Kennedy's iterative algorithm: walk the blocks in
+// reverse postorder, meeting the dominators of the processed predecessors,
+// until nothing changes.
+void
+Cfg::compute_dominators(){
+  for(auto& block: blocks) block.idom = none;
+  blocks[0].idom = 0;
+  auto intersect = [this](std::uint32_t a, std::uint32_t b){
+    while(a != b){
+      while(blocks[a].rpo_index > blocks[b].rpo_index) a = blocks[a].idom;
+      while(blocks[b].rpo_index > blocks[a].rpo_index) b = blocks[b].idom;
+    }
+    return a;
+  };
+  for(bool changed = true; changed;){
+    changed = false;
+    for(std::uint32_t i = 1; i < rpo.size(); ++i){
+      auto& block = blocks[rpo[i]];
+      auto idom = none;
+      for(auto pred: block.preds){
+        if(blocks[pred].idom == none) continue;
+        idom = idom == none ? pred : intersect(pred, idom);
+      }
+      if(block.idom != idom){
+        block.idom = idom;
+        changed = true;
+      }
+    }
+  }
+}
+
+bool
+Cfg::dominates(std::uint32_t a, std::uint32_t b)const{
+  if(!reachable(b)) return false;
+  for(;; b = blocks[b].idom){
+    if(a == b) return true;
+    if(b == 0) return false;
+  }
+}
+
+void
+Cfg::linearize(FunctionDef& fn)const{
+  fn.insts.clear();
+  for(auto& block: blocks)
+    fn.insts.insert(fn.insts.end(), block.insts.begin(), block.insts.end());
+}
+
+void
+Cfg::dump(utils::Sink& out, FunctionDef const& fn)const{
+  auto list = [&out](char const* name, std::vector<std::uint32_t> const& blocks){
+    out << name << '[';
+    for(std::uint32_t i = 0; i < blocks.size(); ++i)
+      out << (i ? ", " : "") << blocks[i];
+    out << ']';
+  };
+  out << "Function " << std::string_view(fn.name, fn.name_len) << ":\n";
+  for(std::uint32_t i = 0; i < blocks.size(); ++i){
+    auto& block = blocks[i];
+    out << "Block " << i;
+    if(reachable(i)) out << " rpo=" << block.rpo_index << " idom=" << block.idom;
+    else out << " unreachable";
+    list(" preds=", block.preds);
+    list(" succs=", block.succs);
+    out << '\n';
+    for(auto& inst: block.insts){
+      out.tabs(1);
+      fn.dump(out, inst);
+    }
+  }
+}
+
+}
+}
@@ -1,117 +1,174 @@
 #include "codegen.h"
+#include "optimizer.h"
+#include "thread_pool.h"
 #include "utils.h"
-#include <fstream>
+#include <cstdio>
+#include <future>
 
 
 namespace niubcc {
 namespace codegen{
 
+namespace{
+// System V integer argument registers, 32-bit views.
+char const* const arg_regs[] = {"%edi", "%esi", "%edx", "%ecx", "%r8d", "%r9d"};
+constexpr unsigned arg_reg_count = 6;
+}
+
+void
+append_one(std::string& out, Operand const& op){
+  switch(op.type){
+    case OperandType::Imm: utils::append(out, '$', op.value); break;
+    case OperandType::Mem: utils::append(out, '-', op.value, "(%rbp)"); break;
+    case OperandType::Reg: out += op.reg; break;
+  }
+}
+
 Operand
-AsmGenerator::get_operand(Ptr<ir::Val> val){
-  if(auto p = std::dynamic_pointer_cast<ir::Var>(val))
-    return Operand(OperandType::Mem, generate(p));
-  if(auto p = std::dynamic_pointer_cast<ir::Constant>(val))
-    return Operand(OperandType::Imm, generate(p));
+AsmGenerator::get_operand(ir::Val val){
+  if(val.is_var())
+    return Operand(OperandType::Mem, std::int64_t{allocate_stack(val.index())});
+  return Operand(OperandType::Imm, fn->value(val));
 }
 
 void
 AsmGenerator::emit_mov(Operand const& src, Operand const& dst){
   if(src.type == OperandType::Mem && dst.type == OperandType::Mem){
-    codes.emplace_back(utils::fmt("movl\t%s, %r10d\n", src.repr.c_str()));
-    codes.emplace_back(utils::fmt("movl\t%r10d, %s\n", dst.repr.c_str()));
+    emit("movl\t", src, ", %r10d\n");
+    emit("movl\t%r10d, ", dst, '\n');
   }else{
-    codes.emplace_back(utils::fmt("movl\t%s, %s\n", src.repr.c_str(), dst.repr.c_str()));
+    emit("movl\t", src, ", ", dst, '\n');
   }
 }
 
 void
 AsmGenerator::emit_cmp(Operand const& src, Operand const& dst){
   if(dst.type == OperandType::Imm){
-    codes.emplace_back(utils::fmt("movl\t%s, %r11d\n", dst.repr.c_str()));
-    codes.emplace_back(utils::fmt("cmpl\t%s, %r11d\n", src.repr.c_str()));
+    emit("movl\t", dst, ", %r11d\n");
+    emit("cmpl\t", src, ", %r11d\n");
   }else if(src.type == OperandType::Mem && dst.type == OperandType::Mem){
-    codes.emplace_back(utils::fmt("movl\t%s, %r10d\n", src.repr.c_str()));
-    codes.emplace_back(utils::fmt("cmpl\t%r10d, %s\n", dst.repr.c_str()));
+    emit("movl\t", src, ", %r10d\n");
+    emit("cmpl\t%r10d, ", dst, '\n');
   }else{
-    codes.emplace_back(utils::fmt("cmpl\t%s, %s\n", src.repr.c_str(), dst.repr.c_str()));
+    emit("cmpl\t", src, ", ", dst, '\n');
   }
 }
 
 void
-AsmGenerator::emit_bin_op(std::string const& op, Operand const& src, Operand const& dst){
-  codes.emplace_back(
-    utils::fmt("%s\t%s, %s\n", op.c_str(), src.repr.c_str(), dst.repr.c_str()));
+AsmGenerator::emit_bin_op(char const* op, Operand const& src, Operand const& dst){
+  emit(op, '\t', src, ", ", dst, '\n');
 }
 
 void 
-AsmGenerator::generate(Ptr<ir::Base> node){
-  if(auto p = std::dynamic_pointer_cast<ir::Program>(node))
-    generate(p);
+AsmGenerator::generate(ir::Program* node){
+  for(auto& funcdef: node->funcdefs){
+    generate(funcdef);
+    label_base += funcdef.label_count;
+  }
+  code += ".section .note.GNU-stack,\"\",@progbits";
 }
 
-void 
-AsmGenerator::generate(Ptr<ir::Program> node){
-  generate(node->funcdef);
-  codes.emplace_back(".section .note.GNU-stack,\"\",@progbits");
-}
+void
+AsmGenerator::generate_parallel(ast::Program* node, ThreadPool& pool, unsigned inline_budget){
+  auto& funcdefs = node->funcdefs;
+  ir::Program program{std::vector<ir::FunctionDef>(funcdefs.size())};
+  auto& lowered = program.funcdefs;
+  std::vector<std::future<void> > done;
+  done.reserve(funcdefs.size());
+  for(std::size_t i = 0; i < funcdefs.size(); ++i)
+    done.push_back(pool.submit([&, i]{
+      ir::AstBuilder builder;
+      lowered[i] = builder.build(funcdefs[i]);
+    }));
+  for(auto& fn_done: done) fn_done.wait();
+
+  // Inlining needs the whole program, so it runs between the two phases.
+  ir::inline_calls(&program, inline_budget);
+  done.clear();
+  for(auto& funcdef: lowered)
+    done.push_back(pool.submit([&funcdef]{ir::optimize(funcdef);}));
+  for(auto& fn_done: done) fn_done.wait();
+
+  // Label numbers only depend on the functions before, so every function
+  // can be generated on its own once the counts are known.
+  std::vector<std::string> outputs(lowered.size());
+  done.clear();
+  for(std::size_t i = 0; i < lowered.size(); ++i){
+    done.push_back(pool.submit([&, i, base = label_base]{
+      AsmGenerator generator;
+      generator.label_base = base;
+      generator.generate(lowered[i]);
+      outputs[i] = std::move(generator.code);
+    }));
+    label_base += lowered[i].label_count;
+  }
+  for(auto& fn_done: done) fn_done.wait();
 
-void 
-AsmGenerator::generate(Ptr<ir::FunctionDef> node){
-  codes.emplace_back(utils::fmt("\t.globl %.*s\n", node->name_len, node->name));
-  codes.emplace_back(utils::fmt("%.*s:\n", node->name_len, node->name));
-  codes.emplace_back("pushq\t%rbp\n");
-  codes.emplace_back("movq\t%rsp, %rbp\n");
-  codes.emplace_back("");
-  auto alloc_stack = codes.size() - 1;
-  generate(node->instructions);
-  codes[alloc_stack] = utils::fmt("subq\t$%u, %rsp\n", stack_allocated);
+  for(auto& output: outputs) code += output;
+  code += ".section .note.GNU-stack,\"\",@progbits";
 }
+
 void 
-AsmGenerator::generate(Ptr<ir::Inst> node){
-  if(!node) return;
-  if(auto p = std::dynamic_pointer_cast<ir::Unary>(node))
-    generate(p);
-  if(auto p = std::dynamic_pointer_cast<ir::Ret>(node))
-    generate(p);
-  if(auto p = std::dynamic_pointer_cast<ir::Binary>(node))
-    generate(p);
-  if(auto p = std::dynamic_pointer_cast<ir::Label>(node))
-    generate(p);
-  if(auto p = std::dynamic_pointer_cast<ir::Jz>(node))
-    generate(p);
-  if(auto p = std::dynamic_pointer_cast<ir::Jnz>(node))
-    generate(p);
-  if(auto p = std::dynamic_pointer_cast<ir::Jmp>(node))
-    generate(p);
-  if(auto p = std::dynamic_pointer_cast<ir::Copy>(node))
-    generate(p);
-
-  generate(node->next);
+AsmGenerator::generate(ir::FunctionDef const& node){
+  // The frame size is only known after the body, so build the body first.
+  fn = &node;
+  body.clear();
+  stack_allocated = 0;
+  // Spill the parameters to their slots; those past the registers were
+  // pushed by the caller above the return address.
+  for(unsigned i = 0; i < node.param_count; ++i){
+    Operand slot(OperandType::Mem, std::int64_t{allocate_stack(i)});
+    if(i < arg_reg_count){
+      emit_mov(Operand(OperandType::Reg, arg_regs[i]), slot);
+      continue;
+    }
+    emit("movl\t", 16 + 8 * (i - arg_reg_count), "(%rbp), %r10d\n");
+    emit_mov(Operand(OperandType::Reg, "%r10d"), slot);
+  }
+  for(auto& inst: node.insts)
+    switch(inst.kind){
+      case ir::Kind::Unary: gen_unary(inst); break;
+      case ir::Kind::Ret: gen_ret(inst); break;
+      case ir::Kind::Binary: gen_binary(inst); break;
+      case ir::Kind::Label: emit(".L", label_base + inst.target, ":\n"); break;
+      case ir::Kind::Jz:
+      case ir::Kind::Jnz:
+      case ir::Kind::Jmp: gen_jump(inst); break;
+      case ir::Kind::Copy: emit_mov(get_operand(inst.src_1), get_operand(inst.dst)); break;
+      case ir::Kind::Call: gen_call(inst); break;
+      case ir::Kind::JumpTable: gen_jump_table(inst); break;
+    }
+  // Keep %rsp 16-byte aligned for calls.
+  auto frame_size = (stack_allocated + 15) & ~15u;
+  std::string_view name(node.name, node.name_len);
+  utils::append(code, "\t.globl ", name, '\n', name, ":\n",
+    "pushq\t%rbp\n", "movq\t%rsp, %rbp\n", "subq\t$", frame_size, ", %rsp\n");
+  code += body;
 }
 
-void 
-AsmGenerator::generate(Ptr<ir::Unary> node){
-  if(node->op == ast::OpType::op_not)
-    return gen_cond_inst(node);
-  auto src_op = get_operand(node->src);
-  auto dst_op = get_operand(node->dst);
+void
+AsmGenerator::gen_unary(ir::Inst const& node){
+  if(node.op == ast::OpType::op_not)
+    return gen_not_inst(node);
+  auto src_op = get_operand(node.src_1);
+  auto dst_op = get_operand(node.dst);
 
   emit_mov(src_op, dst_op);
 
-  switch(node->op){
+  switch(node.op){
     case ast::OpType::op_bitnot: 
-      codes.emplace_back(utils::fmt("notl\t%s\n", dst_op.repr.c_str())); break;
+      emit("notl\t", dst_op, '\n'); break;
     case ast::OpType::op_minus:
-      codes.emplace_back(utils::fmt("negl\t%s\n", dst_op.repr.c_str())); break;
+      emit("negl\t", dst_op, '\n'); break;
     default: assert(0);
   }
 }
 
 void
-AsmGenerator::gen_mul_inst(Ptr<ir::Binary> node){
-  auto src1_op = get_operand(node->src_1);
-  auto src2_op = get_operand(node->src_2);
-  auto dst_op = get_operand(node->dst);
+AsmGenerator::gen_mul_inst(ir::Inst const& node){
+  auto src1_op = get_operand(node.src_1);
+  auto src2_op = get_operand(node.src_2);
+  auto dst_op = get_operand(node.dst);
   
   Operand temp_reg_op(OperandType::Reg, "%r11d");
   
@@ -121,22 +178,22 @@ AsmGenerator::gen_mul_inst(Ptr<ir::Binary> node){
 }
 
 void
-AsmGenerator::gen_div_inst(Ptr<ir::Binary> node){
-  auto src1_op = get_operand(node->src_1);
-  auto src2_op = get_operand(node->src_2);
-  auto dst_op = get_operand(node->dst);
+AsmGenerator::gen_div_inst(ir::Inst const& node){
+  auto src1_op = get_operand(node.src_1);
+  auto src2_op = get_operand(node.src_2);
+  auto dst_op = get_operand(node.dst);
   
   emit_mov(src1_op, Operand(OperandType::Reg, "%eax"));
-  codes.emplace_back("cdq\n");
+  emit("cdq\n");
   
   if(src2_op.type == OperandType::Imm){
     emit_mov(src2_op, Operand(OperandType::Reg, "%r10d"));
-    codes.emplace_back("idivl\t %r10d\n");
+    emit("idivl\t %r10d\n");
   }else{
-    codes.emplace_back(utils::fmt("idivl\t%s\n", src2_op.repr.c_str()));
+    emit("idivl\t", src2_op, '\n');
   }
   
-  if(node->op == ast::OpType::op_slash) {
+  if(node.op == ast::OpType::op_slash) {
     emit_mov(Operand(OperandType::Reg, "%eax"), dst_op);
   }else{
     emit_mov(Operand(OperandType::Reg, "%edx"), dst_op);
@@ -144,15 +201,20 @@ AsmGenerator::gen_div_inst(Ptr<ir::Binary> node){
 }
 
 void
-AsmGenerator::gen_bin_inst(Ptr<ir::Binary> node, std::string const& op_name){
-  auto src1_op = get_operand(node->src_1);
-  auto src2_op = get_operand(node->src_2);
-  auto dst_op = get_operand(node->dst);
+AsmGenerator::gen_bin_inst(ir::Inst const& node, char const* op_name){
+  auto src1_op = get_operand(node.src_1);
+  auto src2_op = get_operand(node.src_2);
+  auto dst_op = get_operand(node.dst);
 
   emit_mov(src1_op, dst_op);
 
   auto actual_src_op = src2_op;
-  if(src2_op.type == OperandType::Mem && dst_op.type == OperandType::Mem){
+  bool is_shift = node.op == ast::OpType::op_lshift || node.op == ast::OpType::op_rshift;
+  if(is_shift && src2_op.type != OperandType::Imm){
+    // A variable shift count must be in %cl.
+    emit_mov(src2_op, Operand(OperandType::Reg, "%ecx"));
+    actual_src_op = Operand(OperandType::Reg, "%cl");
+  }else if(src2_op.type == OperandType::Mem && dst_op.type == OperandType::Mem){
     actual_src_op = Operand(OperandType::Reg, "%r10d");
     emit_mov(src2_op, actual_src_op);
   }
@@ -161,9 +223,9 @@ AsmGenerator::gen_bin_inst(Ptr<ir::Binary> node, std::string const& op_name){
 }
 
 void
-AsmGenerator::generate(Ptr<ir::Binary> node){
-  std::string op_name;
-  switch(node->op){
+AsmGenerator::gen_binary(ir::Inst const& node){
+  char const* op_name;
+  switch(node.op){
     case ast::OpType::op_asterisk: gen_mul_inst(node); return;
     case ast::OpType::op_slash:
     case ast::OpType::op_percent: gen_div_inst(node); return;
@@ -182,18 +244,18 @@ bin_inst:
 }
 
 void
-AsmGenerator::gen_cond_inst(Ptr<ir::Binary> node){
+AsmGenerator::gen_cond_inst(ir::Inst const& node){
   // cmpl src2, src1
   // movl $0, dst
   // setflag dst
-  auto src1 = get_operand(node->src_1);
-  auto src2 = get_operand(node->src_2);
+  auto src1 = get_operand(node.src_1);
+  auto src2 = get_operand(node.src_2);
   emit_cmp(src2, src1); // src1 and src2 could be both memory.
-  auto dst = generate(node->dst);
-  codes.emplace_back(utils::fmt("movl\t$0, %s\n", dst.c_str()));
+  auto dst = get_operand(node.dst);
+  emit("movl\t$0, ", dst, '\n');
 
-  std::string instuction;
-  switch(node->op){
+  char const* instuction;
+  switch(node.op){
     case ast::OpType::op_eq: instuction = "sete"; break;
     case ast::OpType::op_ne: instuction = "setne"; break;
     case ast::OpType::op_le: instuction = "setle"; break;
@@ -203,88 +265,88 @@ AsmGenerator::gen_cond_inst(Ptr<ir::Binary> node){
     default: assert(0 && "unreachabel");
   }
 
-  codes.emplace_back(utils::fmt("%s\t%s\n", instuction.c_str(), dst.c_str()));
+  emit(instuction, '\t', dst, '\n');
 }
 
 void
-AsmGenerator::gen_cond_inst(Ptr<ir::Unary> node){
-  // definitely logic not
+AsmGenerator::gen_not_inst(ir::Inst const& node){
   // cmpl $0, src
   // movel $0, dst
   // sete dst
-  codes.emplace_back(utils::fmt("cmpl\t$0, %s\n", generate(node->src).c_str()));
-  auto dst = generate(node->dst);
-  codes.emplace_back(utils::fmt("movl\t$0, %s\n", dst.c_str()));
-  codes.emplace_back(utils::fmt("sete\t%s\n", dst.c_str()));
-}
-
-void
-AsmGenerator::generate(Ptr<ir::Jmp> node){
-  codes.emplace_back(utils::fmt("jmp\t.L%u\n", node->label));
+  emit_cmp(Operand(OperandType::Imm, std::int64_t{0}), get_operand(node.src_1));
+  auto dst = get_operand(node.dst);
+  emit("movl\t$0, ", dst, '\n');
+  emit("sete\t", dst, '\n');
 }
 
 void
-AsmGenerator::generate(Ptr<ir::Jnz> node){
-  codes.emplace_back(utils::fmt("cmpl\t$0, %s\n", generate(node->cond).c_str()));
-  codes.emplace_back(utils::fmt("jne\t.L%u\n", node->label));
+AsmGenerator::gen_jump(ir::Inst const& node){
+  if(node.kind != ir::Kind::Jmp)
+    emit_cmp(Operand(OperandType::Imm, std::int64_t{0}), get_operand(node.src_1));
+  char const* jump = node.kind == ir::Kind::Jmp ? "jmp" : node.kind == ir::Kind::Jz ? "je" : "jne";
+  emit(jump, "\t.L", label_base + node.target, '\n');
 }
 
 void
-AsmGenerator::generate(Ptr<ir::Jz> node){
-  codes.emplace_back(utils::fmt("cmpl\t$0, %s\n", generate(node->cond).c_str()));
-  codes.emplace_back(utils::fmt("je\t.L%u\n", node->label));
-}
+AsmGenerator::gen_call(ir::Inst const& node){
+  // Arguments past the registers are pushed right to left, padded so that
+  // %rsp stays 16-byte aligned at the call.
+  auto& site = fn->calls[node.target];
+  auto args = fn->args.data() + site.first_arg;
+  unsigned arg_count = site.arg_count;
+  unsigned stack_args = arg_count > arg_reg_count ? arg_count - arg_reg_count : 0;
+  unsigned padding = stack_args % 2 ? 8 : 0;
+  if(padding) emit("subq\t$8, %rsp\n");
+  for(auto i = arg_count; i-- > arg_reg_count;){
+    auto arg = get_operand(args[i]);
+    if(arg.type == OperandType::Imm) emit("pushq\t", arg, '\n');
+    else emit("movl\t", arg, ", %eax\n", "pushq\t%rax\n");
+  }
+  for(unsigned i = 0; i < arg_count && i < arg_reg_count; ++i)
+    emit_mov(get_operand(args[i]), Operand(OperandType::Reg, arg_regs[i]));
 
-void
-AsmGenerator::generate(Ptr<ir::Copy> node){
-  auto src = get_operand(node->src);
-  auto dst = get_operand(node->dst);
-  emit_mov(src, dst);
+  emit("call\t", std::string_view(site.name, site.name_len), '\n');
+  if(stack_args) emit("addq\t$", stack_args * 8 + padding, ", %rsp\n");
+  emit_mov(Operand(OperandType::Reg, "%eax"), get_operand(node.dst));
 }
 
+// The table holds 32-bit offsets from its own start, which keeps it
+// position independent.
 void
-AsmGenerator::generate(Ptr<ir::Label> node){
-  codes.emplace_back(utils::fmt(".L%u:\n", node->number));
+AsmGenerator::gen_jump_table(ir::Inst const& node){
+  auto& table = fn->tables[node.target];
+  auto label = label_base + table.label;
+  emit("movl\t", get_operand(node.src_1), ", %eax\n",
+    "leaq\t.L", label, "(%rip), %rcx\n",
+    "movslq\t(%rcx,%rax,4), %rax\n",
+    "addq\t%rcx, %rax\n",
+    "jmp\t*%rax\n",
+    ".section .rodata\n", ".align 4\n", ".L", label, ":\n");
+  for(std::uint32_t i = 0; i < table.target_count; ++i)
+    emit(".long\t.L", label_base + fn->targets[table.first_target + i], "-.L", label, '\n');
+  emit(".text\n");
 }
 
 void 
-AsmGenerator::generate(Ptr<ir::Ret> node){
-  codes.emplace_back(utils::fmt("movl\t%s, %%eax\n", 
-    generate(node->val).c_str()));
-  codes.emplace_back("movq\t%rbp, %rsp\n");
-  codes.emplace_back("popq\t%rbp\n");
-  codes.emplace_back("ret\n");
+AsmGenerator::gen_ret(ir::Inst const& node){
+  emit("movl\t", get_operand(node.src_1), ", %eax\n");
+  emit("movq\t%rbp, %rsp\n", "popq\t%rbp\n", "ret\n");
 }
 
-std::string
-AsmGenerator::generate(Ptr<ir::Val> node){
-  if(auto p = std::dynamic_pointer_cast<ir::Var>(node))
-    return generate(p);
-  if(auto p = std::dynamic_pointer_cast<ir::Constant>(node))
-    return generate(p);
-  return 0;
-}
-
-std::string
-AsmGenerator::generate(Ptr<ir::Var> node){
-  return utils::fmt("-%u(%rbp)", allocate_stack(node->number));
-}
-
-std::string
-AsmGenerator::generate(Ptr<ir::Constant> node){
-  return utils::fmt("$%.*s", node->val_len, node->val);
+void
+AsmGenerator::emie_code(char const* filename)const{
+  write_code(code, filename);
 }
 
-
 void
-AsmGenerator::emie_code(char const* filename)const{
-  std::ofstream file(filename);
+write_code(std::string const& code, char const* filename){
+  auto file = std::fopen(filename, "w");
   if(!file){
     fprintf(stderr, "cannot create file %s.\n", filename);
     std::terminate();
   }
-  for(auto& code: codes)
-    file << code;
+  std::fwrite(code.data(), 1, code.size(), file);
+  std::fclose(file);
 }
 
 }
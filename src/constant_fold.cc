@@ -0,0 +1,137 @@
+#include "optimizer.h"
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+
+namespace niubcc{
+namespace ir{
+
+std::optional<std::int32_t>
+fold_unary(ast::OpType op, std::int32_t value){
+  switch(op){
+    case ast::OpType::op_minus: return 0u - static_cast<std::uint32_t>(value);
+    case ast::OpType::op_bitnot: return ~value;
+    case ast::OpType::op_not: return !value;
+    default: return std::nullopt;
+  }
+}
+
+// Wrapping arithmetic goes through uint32_t; the conversion back is
+// modular in every compiler we build with.
+std::optional<std::int32_t>
+fold_binary(ast::OpType op, std::int32_t lhs, std::int32_t rhs){
+  auto ulhs = static_cast<std::uint32_t>(lhs);
+  auto urhs = static_cast<std::uint32_t>(rhs);
+  switch(op){
+    case ast::OpType::op_plus: return ulhs + urhs;
+    case ast::OpType::op_minus: return ulhs - urhs;
+    case ast::OpType::op_asterisk: return ulhs * urhs;
+    case ast::OpType::op_slash:
+    case ast::OpType::op_percent:
+      if(rhs == 0 || (lhs == INT32_MIN && rhs == -1)) return std::nullopt;
+      return op == ast::OpType::op_slash ? lhs / rhs : lhs % rhs;
+    case ast::OpType::op_bitand: return lhs & rhs;
+    case ast::OpType::op_bitor: return lhs | rhs;
+    case ast::OpType::op_bitxor: return lhs ^ rhs;
+    case ast::OpType::op_lshift:
+      if(rhs < 0 || rhs > 31) return std::nullopt;
+      return ulhs << rhs;
+    case ast::OpType::op_rshift:
+      if(rhs < 0 || rhs > 31) return std::nullopt;
+      return lhs >> rhs;
+    case ast::OpType::op_eq: return lhs == rhs;
+    case ast::OpType::op_ne: return lhs != rhs;
+    case ast::OpType::op_lt: return lhs < rhs;
+    case ast::OpType::op_le: return lhs <= rhs;
+    case ast::OpType::op_gt: return lhs > rhs;
+    case ast::OpType::op_ge: return lhs >= rhs;
+    default: return std::nullopt;
+  }
+}
+
+bool
+fold_constants(FunctionDef& fn){
+  // A Var with a single assignment holds that value wherever it is
+  // initialized; parameters also hold what the caller passed.
+  std::vector<std::uint32_t> defs(fn.tmp_count);
+  for(auto& inst: fn.insts)
+    if(!inst.dst.is_null()) ++defs[inst.dst.index()];
+  std::vector<std::optional<std::int32_t> > known(fn.tmp_count);
+
+  // Reuse pool entries for the constants made here.
+  std::unordered_map<std::int64_t, Val> pool;
+  auto constant = [&fn, &pool](std::int32_t value){
+    if(pool.empty())
+      for(std::uint32_t i = fn.constants.size(); i-- > 0;)
+        pool[fn.constants[i]] = Val::constant(i);
+    auto [it, inserted] = pool.try_emplace(value);
+    if(inserted) it->second = fn.add_constant(value);
+    return it->second;
+  };
+
+  bool changed = false;
+  auto value = [&fn](Val val){return static_cast<std::int32_t>(fn.value(val));};
+  auto use = [&](Val& val){
+    if(!val.is_var() || !known[val.index()]) return;
+    val = constant(*known[val.index()]);
+    changed = true;
+  };
+
+  std::size_t out = 0;
+  for(auto inst: fn.insts){
+    use(inst.src_1);
+    use(inst.src_2);
+    if(inst.kind == Kind::Call){
+      auto& site = fn.calls[inst.target];
+      for(std::uint32_t i = 0; i < site.arg_count; ++i)
+        use(fn.args[site.first_arg + i]);
+    }
+
+    std::optional<std::int32_t> result;
+    switch(inst.kind){
+      case Kind::Unary:
+        if(inst.src_1.is_constant()) result = fold_unary(inst.op, value(inst.src_1));
+        break;
+      case Kind::Binary:
+        if(inst.src_1.is_constant() && inst.src_2.is_constant())
+          result = fold_binary(inst.op, value(inst.src_1), value(inst.src_2));
+        break;
+      case Kind::Copy:
+        if(inst.src_1.is_constant()) result = value(inst.src_1);
+        break;
+      case Kind::Jz:
+      case Kind::Jnz:
+        if(!inst.src_1.is_constant()) break;
+        changed = true;
+        if((value(inst.src_1) == 0) != (inst.kind == Kind::Jz)) continue;
+        inst = Inst::jmp(inst.target);
+        break;
+      case Kind::JumpTable:{
+        // An index out of range can only be reached past the range checks.
+        auto& table = fn.tables[inst.target];
+        if(!inst.src_1.is_constant()) break;
+        auto index = static_cast<std::uint32_t>(value(inst.src_1));
+        if(index >= table.target_count) break;
+        inst = Inst::jmp(fn.targets[table.first_target + index]);
+        changed = true;
+        break;
+      }
+      default: break;
+    }
+
+    if(result){
+      if(inst.kind != Kind::Copy){
+        inst = Inst::copy(constant(*result), inst.dst);
+        changed = true;
+      }
+      auto dst = inst.dst.index();
+      if(dst >= fn.param_count && defs[dst] == 1) known[dst] = result;
+    }
+    fn.insts[out++] = inst;
+  }
+  fn.insts.resize(out);
+  return changed;
+}
+
+}
+}
@@ -0,0 +1,134 @@
+#include "bit_set.h"
+#include "cfg.h"
+#include "optimizer.h"
+#include <cstdint>
+
+namespace niubcc{
+namespace ir{
+
+namespace{
+struct CopyFact{
+  Val src;
+  Val dst;
+};
+}
+
+// Reaching copies: a copy `dst = src` reaches a point if it is on every
+// path there and neither side is assigned in between. A use of dst where
+// the copy reaches can read src instead. Vars cannot be written behind
+// our back, since nothing takes their address.
+bool
+propagate_copies(FunctionDef& fn){
+  auto cfg = Cfg::build(fn);
+  auto& blocks = cfg.blocks;
+
+  std::vector<CopyFact> copies;
+  // Copies that mention each Var on either side.
+  std::vector<std::vector<std::uint32_t> > mentions(fn.tmp_count);
+  // Copies in instruction order, as the walks below meet them.
+  for(auto& block: blocks)
+    for(auto& inst: block.insts){
+      if(inst.kind != Kind::Copy || inst.src_1 == inst.dst) continue;
+      auto id = static_cast<std::uint32_t>(copies.size());
+      copies.push_back({inst.src_1, inst.dst});
+      mentions[inst.dst.index()].push_back(id);
+      if(inst.src_1.is_var()) mentions[inst.src_1.index()].push_back(id);
+    }
+  if(copies.empty()) return false;
+
+  // Apply one instruction to the copies reaching it; next_copy walks the
+  // copy ids alongside.
+  auto transfer = [&](BitSet& reaching, Inst const& inst, std::uint32_t& next_copy){
+    if(inst.dst.is_null()) return;
+    for(auto id: mentions[inst.dst.index()]) reaching.reset(id);
+    if(inst.kind == Kind::Copy && inst.src_1 != inst.dst) reaching.set(next_copy++);
+  };
+  std::vector<std::uint32_t> first_copy(blocks.size() + 1);
+  for(std::uint32_t i = 0; i < blocks.size(); ++i){
+    first_copy[i + 1] = first_copy[i];
+    for(auto& inst: blocks[i].insts)
+      if(inst.kind == Kind::Copy && inst.src_1 != inst.dst) ++first_copy[i + 1];
+  }
+
+  // Copies reaching the start of each block. Those not yet computed hold
+  // all copies, the identity of the meet.
+  std::vector<BitSet> in, out;
+  bool global = blocks.size() * copies.size() <= max_dataflow_bits;
+  if(global){
+    in.assign(blocks.size(), BitSet(copies.size(), true));
+    out.assign(blocks.size(), BitSet(copies.size(), true));
+    in[0].clear();
+    for(bool changed = true; changed;){
+      changed = false;
+      for(auto b: cfg.rpo){
+        auto& block = blocks[b];
+        if(b != 0){
+          in[b] = BitSet(copies.size(), true);
+          for(auto pred: block.preds) in[b].intersect(out[pred]);
+        }
+        auto reaching = in[b];
+        auto next_copy = first_copy[b];
+        for(auto& inst: block.insts) transfer(reaching, inst, next_copy);
+        if(reaching != out[b]){
+          out[b] = std::move(reaching);
+          changed = true;
+        }
+      }
+    }
+  }
+
+  bool changed = false;
+  for(std::uint32_t b = 0; b < blocks.size(); ++b){
+    auto reaching = global && cfg.reachable(b) ? in[b] : BitSet(copies.size(), false);
+    auto next_copy = first_copy[b];
+    auto use = [&](Val& val){
+      if(!val.is_var()) return;
+      for(auto id: mentions[val.index()])
+        if(copies[id].dst == val && reaching.test(id)){
+          val = copies[id].src;
+          changed = true;
+          return;
+        }
+    };
+    for(auto& inst: blocks[b].insts){
+      // Facts come from the instruction as it was; the rewritten one reads
+      // the same values.
+      auto before = inst;
+      use(inst.src_1);
+      use(inst.src_2);
+      if(inst.kind == Kind::Call){
+        auto& site = fn.calls[inst.target];
+        for(std::uint32_t i = 0; i < site.arg_count; ++i)
+          use(fn.args[site.first_arg + i]);
+      }
+      transfer(reaching, before, next_copy);
+    }
+  }
+
+  // Drop copies that are no-ops now or whose destination is never read.
+  std::vector<std::uint32_t> reads(fn.tmp_count);
+  auto read = [&reads](Val val){if(val.is_var()) ++reads[val.index()];};
+  for(auto& block: blocks)
+    for(auto& inst: block.insts){
+      read(inst.src_1);
+      read(inst.src_2);
+    }
+  for(auto arg: fn.args) read(arg);
+  for(auto& block: blocks){
+    std::size_t kept = 0;
+    for(auto& inst: block.insts){
+      if(inst.kind == Kind::Copy && (inst.src_1 == inst.dst || !reads[inst.dst.index()])){
+        changed = true;
+        continue;
+      }
+      block.insts[kept++] = inst;
+    }
+    block.insts.resize(kept);
+  }
+
+  cfg.linearize(fn);
+  return changed;
+}
+
+}
+}
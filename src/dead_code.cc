@@ -0,0 +1,94 @@
+#include "bit_set.h"
+#include "cfg.h"
+#include "optimizer.h"
+
+namespace niubcc{
+namespace ir{
+
+namespace{
+bool
+is_pure(Inst const& inst){
+  return inst.kind == Kind::Unary || inst.kind == Kind::Binary || inst.kind == Kind::Copy;
+}
+
+// Vars read by inst.
+template<class F>
+void
+for_each_use(FunctionDef const& fn, Inst const& inst, F f){
+  if(inst.src_1.is_var()) f(inst.src_1.index());
+  if(inst.src_2.is_var()) f(inst.src_2.index());
+  if(inst.kind != Kind::Call) return;
+  auto& site = fn.calls[inst.target];
+  for(std::uint32_t i = 0; i < site.arg_count; ++i)
+    if(auto arg = fn.args[site.first_arg + i]; arg.is_var()) f(arg.index());
+}
+}
+
+// Backward liveness: a Var is live where some path reads it before it is
+// assigned again. Blocks are visited in postorder, so most successors are
+// done first; unreachable blocks are removed elsewhere and only need to
+// keep what they read alive.
+bool
+eliminate_dead_code(FunctionDef& fn){
+  bool changed = false;
+  for(bool removed = true; removed;){
+    removed = false;
+    auto cfg = Cfg::build(fn);
+    auto& blocks = cfg.blocks;
+    bool global = blocks.size() * fn.tmp_count <= max_dataflow_bits;
+
+    // Nothing is live after a return or at the end of the function.
+    std::vector<BitSet> live_in(blocks.size(), BitSet(fn.tmp_count, !global));
+    auto live_out = [&](std::uint32_t b){
+      BitSet live(fn.tmp_count, !global);
+      for(auto succ: blocks[b].succs) live.unite(live_in[succ]);
+      return live;
+    };
+    auto step = [&fn](BitSet& live, Inst const& inst){
+      if(!inst.dst.is_null()) live.reset(inst.dst.index());
+      for_each_use(fn, inst, [&live](std::uint32_t var){live.set(var);});
+    };
+    if(global){
+      std::vector<std::uint32_t> order(cfg.rpo.rbegin(), cfg.rpo.rend());
+      for(std::uint32_t b = 0; b < blocks.size(); ++b)
+        if(!cfg.reachable(b)) order.push_back(b);
+      for(bool again = true; again;){
+        again = false;
+        for(auto b: order){
+          auto live = live_out(b);
+          auto& insts = blocks[b].insts;
+          for(auto it = insts.rbegin(); it != insts.rend(); ++it) step(live, *it);
+          if(live != live_in[b]){
+            live_in[b] = std::move(live);
+            again = true;
+          }
+        }
+      }
+    }
+
+    for(std::uint32_t b = 0; b < blocks.size(); ++b){
+      auto live = live_out(b);
+      auto& insts = blocks[b].insts;
+      // Walk backwards, keeping the survivors at the end of the vector.
+      auto kept = insts.size();
+      for(auto i = insts.size(); i-- > 0;){
+        auto& inst = insts[i];
+        if(is_pure(inst) && !live.test(inst.dst.index())){
+          removed = true;
+          continue;
+        }
+        step(live, inst);
+        insts[--kept] = inst;
+      }
+      insts.erase(insts.begin(), insts.begin() + kept);
+    }
+    if(removed){
+      cfg.linearize(fn);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+}
+}
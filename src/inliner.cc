@@ -0,0 +1,115 @@
+#include "inliner.h"
+#include <string_view>
+#include <unordered_map>
+
+namespace niubcc{
+namespace ir{
+
+namespace{
+// Append a copy of the callee's body for one call to out. Its Vars and
+// labels are shifted past the caller's and its pools appended to the
+// caller's; the arguments are copied into the parameters first, and every
+// return becomes a copy into the call's result and a jump to a label
+// after the body.
+void
+clone_body(FunctionDef const& callee, FunctionDef& caller, Inst const& call, std::vector<Inst>& out){
+  auto tmp_base = caller.tmp_count;
+  auto label_base = caller.label_count;
+  auto constant_base = static_cast<std::uint32_t>(caller.constants.size());
+  auto val = [&](Val val){
+    if(val.is_var()) return Val::var(val.index() + tmp_base);
+    return Val::constant(val.index() + constant_base);
+  };
+  caller.constants.insert(caller.constants.end(), callee.constants.begin(), callee.constants.end());
+
+  auto site = caller.calls[call.target];
+  for(std::uint32_t i = 0; i < site.arg_count; ++i)
+    out.push_back(Inst::copy(caller.args[site.first_arg + i], Val::var(tmp_base + i)));
+
+  auto end = label_base + callee.label_count;
+  for(auto inst: callee.insts){
+    switch(inst.kind){
+      case Kind::Ret:
+        out.push_back(Inst::copy(val(inst.src_1), call.dst));
+        out.push_back(Inst::jmp(end));
+        continue;
+      case Kind::Label:
+      case Kind::Jmp:
+      case Kind::Jnz:
+      case Kind::Jz:
+        inst.target += label_base;
+        break;
+      case Kind::Call:{
+        auto callee_site = callee.calls[inst.target];
+        auto first_arg = static_cast<std::uint32_t>(caller.args.size());
+        for(std::uint32_t i = 0; i < callee_site.arg_count; ++i)
+          caller.args.push_back(val(callee.args[callee_site.first_arg + i]));
+        caller.calls.push_back({callee_site.name, callee_site.name_len, first_arg, callee_site.arg_count});
+        inst.target = caller.calls.size() - 1;
+        break;
+      }
+      case Kind::JumpTable:{
+        auto table = callee.tables[inst.target];
+        auto first_target = static_cast<std::uint32_t>(caller.targets.size());
+        for(std::uint32_t i = 0; i < table.target_count; ++i)
+          caller.targets.push_back(callee.targets[table.first_target + i] + label_base);
+        caller.tables.push_back({table.label + label_base, first_target, table.target_count});
+        inst.target = caller.tables.size() - 1;
+        break;
+      }
+      default: break;
+    }
+    if(!inst.src_1.is_null()) inst.src_1 = val(inst.src_1);
+    if(!inst.src_2.is_null()) inst.src_2 = val(inst.src_2);
+    if(!inst.dst.is_null()) inst.dst = val(inst.dst);
+    out.push_back(inst);
+  }
+
+  out.push_back(Inst::label(end));
+  caller.tmp_count += callee.tmp_count;
+  caller.label_count += callee.label_count + 1;
+}
+}
+
+void
+inline_calls(Program* program, unsigned budget){
+  std::unordered_map<std::string_view, FunctionDef*> functions;
+  for(auto& funcdef: program->funcdefs)
+    functions[std::string_view(funcdef.name, funcdef.name_len)] = &funcdef;
+  auto callee_of = [&functions](FunctionDef const& fn, Inst const& inst)->FunctionDef*{
+    if(inst.kind != Kind::Call) return 0;
+    auto& site = fn.calls[inst.target];
+    auto it = functions.find(std::string_view(site.name, site.name_len));
+    return it == functions.end() ? 0 : it->second;
+  };
+
+  std::unordered_map<FunctionDef*, unsigned> sizes, call_sites;
+  for(auto& funcdef: program->funcdefs){
+    sizes[&funcdef] = funcdef.insts.size();
+    for(auto& inst: funcdef.insts)
+      if(auto callee = callee_of(funcdef, inst)) ++call_sites[callee];
+  }
+
+  std::vector<Inst> insts;
+  for(auto& funcdef: program->funcdefs){
+    auto caller = &funcdef;
+    unsigned grown = 0;
+    insts.clear();
+    for(auto& inst: caller->insts){
+      auto callee = callee_of(*caller, inst);
+      if(!callee || callee == caller
+        || (sizes[callee] > small_function_size && call_sites[callee] != 1)
+        || grown + sizes[callee] > budget){
+        insts.push_back(inst);
+        continue;
+      }
+      clone_body(*callee, *caller, inst, insts);
+      grown += sizes[callee];
+    }
+    if(grown) caller->insts.swap(insts);
+    sizes[caller] += grown;
+  }
+}
+
+}
+}
@@ -0,0 +1,37 @@
+#include "interner.h"
+
+namespace niubcc{
+
+std::uint32_t
+Interner::intern(std::string_view spelling, std::uint32_t hash){
+  std::size_t mask = slots.size() - 1;
+  for(std::size_t i = hash & mask;; i = (i + 1) & mask){
+    auto& slot = slots[i];
+    if(!slot.id){
+      std::uint32_t id = spellings.size();
+      spellings.push_back(spelling);
+      hashes.push_back(hash);
+      slot = Slot{hash, id + 1};
+      // Keep the load factor under one half.
+      if(spellings.size() * 2 > slots.size()) grow();
+      return id;
+    }
+    if(slot.hash == hash && spellings[slot.id - 1] == spelling)
+      return slot.id - 1;
+  }
+}
+
+void
+Interner::grow(){
+  std::vector<Slot> old(slots.size() * 2);
+  old.swap(slots);
+  std::size_t mask = slots.size() - 1;
+  for(auto& slot: old){
+    if(!slot.id) continue;
+    std::size_t i = slot.hash & mask;
+    while(slots[i].id) i = (i + 1) & mask;
+    slots[i] = slot;
+  }
+}
+
+}
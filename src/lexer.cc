@@ -1,11 +1,67 @@
 #include <cctype>
 #include <cstring>
 #include <cstdio>
+#include <climits>
+#include <thread>
 #include "lexer.h"
+#include "spsc_queue.h"
+#include "thread_pool.h"
 #include "utils.h"
 
 namespace niubcc{
 
+namespace{
+struct Keyword{
+  char const* spelling;
+  TokenType type;
+};
+
+Keyword const keywords[]{
+  {"int", TokenType::kw_int},
+  {"return", TokenType::kw_ret},
+  {"void", TokenType::kw_void},
+  {"if", TokenType::kw_if},
+  {"else", TokenType::kw_else},
+  {"while", TokenType::kw_while},
+  {"do", TokenType::kw_do},
+  {"for", TokenType::kw_for},
+  {"break", TokenType::kw_break},
+  {"continue", TokenType::kw_continue},
+  {"goto", TokenType::kw_goto},
+  {"switch", TokenType::kw_switch},
+  {"case", TokenType::kw_case},
+  {"default", TokenType::kw_default},
+};
+}
+
+unsigned const Lexer::keyword_count = sizeof(keywords) / sizeof(keywords[0]);
+
+Lexer::Lexer(char const* _ptr): text_ptr(_ptr){
+  for(auto& keyword: keywords)
+    interner.intern(keyword.spelling);
+}
+
+Lexer::Lexer(char const* begin, char const* end): Lexer(begin){
+  end_ptr = end;
+}
+
+struct Lexer::Pipeline{
+  SpscQueue<Token> queue{16 * pipeline_batch};
+  std::thread thread{};
+  // Set when the consumer goes away before the end of input.
+  std::atomic<bool> cancelled{false};
+  // Published before the token that stands for it.
+  std::optional<LexerError> error{};
+};
+
+Lexer::Lexer(Lexer&&) = default;
+
+Lexer::~Lexer(){
+  if(!pipeline) return;
+  pipeline->cancelled.store(true, std::memory_order_relaxed);
+  pipeline->thread.join();
+}
+
 void
  Lexer::err_handler(LexerError const& err){
   std::string msg = err.to_string();
@@ -15,29 +71,47 @@ void
  }
 
 void
-Lexer::tokenize(){
-  while(1){
-    auto res = lex_one_token();
+Lexer::fill(unsigned count){
+  while(ring_count < count){
+    Token& token = ring[(ring_head + ring_count) % ring_size];
+    if(pipeline){
+      if(lexed_pos == lexed.size()) receive();
+      token = lexed[lexed_pos];
+      // The last token of the stream stands for end of input, or for the
+      // lexical error the lexer thread stopped at, and is repeated forever.
+      if(!token.is(TokenType::unknown)) ++lexed_pos;
+      else if(pipeline->error) err_handler(*pipeline->error);
+      ++ring_count;
+      continue;
+    }
+    if(is_pre_lexed){
+      if(lexed_pos < lexed.size())
+        token = lexed[lexed_pos++];
+      else{
+        token.init();
+        token.pos = {col, line};
+      }
+      ++ring_count;
+      continue;
+    }
+    auto res = lex_one_token(token);
     if(res.is_err())
       res.handle_err(Lexer::err_handler);
-    if(!res.unwrap()) break;
+    // Once the input is exhausted every further token is an unknown one,
+    // which the parser treats as end of input.
+    if(!res.unwrap()){
+      token.init();
+      token.pos = {col, line};
+    }
+    ++ring_count;
   }
-  // In case the actual token number exactly equal to tokens' len
-  // Then it will lead to ub if the parser call method on the last token.
-  if(tok_pos == tok_max_len)
-    tokens.emplace_back();
 }
 
 Expected<bool, LexerError>
-Lexer::lex_one_token(){
+Lexer::lex_one_token(Token& token){
   cur_ptr = text_ptr;
   if(!skip_whitespace()) return false;
 
-  if(tok_pos == tok_max_len){
-    tok_max_len *= 2;
-    tokens.resize(tok_max_len);
-  }
-  Token& token = tokens[tok_pos++];
   token.init();
 
   if(std::isdigit(*cur_ptr)) return lex_number(token);
@@ -125,7 +199,7 @@ Lexer::lex_one_token(){
 
 bool
 Lexer::skip_whitespace(){
-  while(std::isspace(*cur_ptr)){
+  while(cur_ptr != end_ptr && std::isspace(*cur_ptr)){
     if(*cur_ptr++ == '\n'){
       ++line;
       col = 1;
@@ -134,12 +208,28 @@ Lexer::skip_whitespace(){
     }
   }
   text_ptr = cur_ptr;
-  return *cur_ptr == EOF ? false : true;
+  return cur_ptr != end_ptr && *cur_ptr != EOF;
 }
 
-bool
+Expected<bool, LexerError>
 Lexer::lex_number(Token& token){
-  while(std::isdigit(*cur_ptr)) ++cur_ptr;
+  // A leading zero introduces an octal constant, as in C.
+  std::uint64_t base = *cur_ptr == '0' ? 8 : 10;
+  std::uint64_t value = 0;
+  bool overflow = false;
+  for(; std::isdigit(*cur_ptr); ++cur_ptr){
+    std::uint64_t digit = *cur_ptr - '0';
+    if(digit >= base)
+      return LexerError("Invalid digit in octal constant", {col, line});
+    if(value > (UINT64_MAX - digit) / base) overflow = true;
+    value = value * base + digit;
+  }
+  if(overflow)
+    return LexerError("Integer literal is too large", {col, line});
+  if(value > INT_MAX)
+    return LexerError("Integer constant is out of range for int", {col, line});
+
+  token.int_value = value;
   token.p_text = text_ptr;
   token.len = static_cast<unsigned>(cur_ptr - text_ptr);
   token.pos = {col, line};
@@ -148,59 +238,158 @@ Lexer::lex_number(Token& token){
   token.addtional_len = token.len;
   text_ptr = cur_ptr;
   col += token.len;
-  return *cur_ptr == EOF ? false : true;
+  return true;
 }
 
 bool
 Lexer::lex_ident_or_kw(Token& token){
-  while(is_valid_ident_char(*cur_ptr)) ++cur_ptr;
+  std::uint32_t hash = Interner::hash_seed;
+  while(is_valid_ident_char(*cur_ptr))
+    hash = Interner::hash_step(hash, *cur_ptr++);
   token.p_text = text_ptr;
   token.len = static_cast<unsigned>(cur_ptr - text_ptr);
   token.pos = {col, line};
-  if(utils::string_equal(text_ptr, "int", token.len))
-    token.type = TokenType::kw_int;
-  else if(utils::string_equal(text_ptr, "return", token.len))
-    token.type = TokenType::kw_ret;
-  else if(utils::string_equal(text_ptr, "void", token.len))
-    token.type = TokenType::kw_void;
-  else if(utils::string_equal(text_ptr, "if", token.len))
-    token.type = TokenType::kw_if;
-  else if(utils::string_equal(text_ptr, "else", token.len))
-    token.type = TokenType::kw_else;
-  else if(utils::string_equal(text_ptr, "while", token.len))
-    token.type = TokenType::kw_while;
-  else if(utils::string_equal(text_ptr, "do", token.len))
-    token.type = TokenType::kw_do;
-  else if(utils::string_equal(text_ptr, "for", token.len))
-    token.type = TokenType::kw_for;
-  else if(utils::string_equal(text_ptr, "break", token.len))
-    token.type = TokenType::kw_break;
-  else if(utils::string_equal(text_ptr, "continue", token.len))
-    token.type = TokenType::kw_continue;
-  else if(utils::string_equal(text_ptr, "goto", token.len))
-    token.type = TokenType::kw_goto;
+  auto id = interner.intern(std::string_view(text_ptr, token.len), hash);
+  if(id < keyword_count)
+    token.type = keywords[id].type;
   else{
     token.type = TokenType::ident;
     token.raw_indent = text_ptr;
     token.addtional_len = token.len;
+    token.ident_id = id;
   }
   col += token.len;
   text_ptr = cur_ptr;
-  return *cur_ptr == EOF ? false : true;
+  return true;
 }
 bool 
 Lexer::is_valid_ident_char(char c){
   return std::isalnum(c) || c == '_';
 }
 
-std::vector<Token> const&
-Lexer::get_tokens()const{
-  return tokens;
+Expected<bool, LexerError>
+Lexer::lex_chunk(std::vector<Token>& out){
+  while(1){
+    Token token;
+    auto res = lex_one_token(token);
+    if(res.is_err()) return res.unwrap_err();
+    if(!res.unwrap()) return true;
+    out.push_back(token);
+  }
+}
+
+void
+Lexer::tokenize_parallel(ThreadPool& pool, unsigned long length){
+  // Tokens never span whitespace (there are no string literals or comments),
+  // so any whitespace character is a safe place to split.
+  char const* end = text_ptr + length;
+  unsigned long chunk_size = length / (pool.size() * 4) + 1;
+  if(chunk_size < min_chunk_size) chunk_size = min_chunk_size;
+  std::vector<char const*> bounds{text_ptr};
+  for(char const* p = text_ptr + chunk_size; p < end; p += chunk_size){
+    while(p < end && !std::isspace(*p)) ++p;
+    if(p >= end) break;
+    bounds.push_back(p);
+  }
+  bounds.push_back(end);
+
+  unsigned chunk_num = bounds.size() - 1;
+  std::vector<Lexer> chunks;
+  chunks.reserve(chunk_num);
+  for(unsigned i = 0; i < chunk_num; ++i)
+    chunks.push_back(Lexer(bounds[i], bounds[i + 1]));
+  std::vector<std::vector<Token> > chunk_tokens(chunk_num);
+  std::vector<std::optional<LexerError> > errors(chunk_num);
+
+  std::vector<std::future<void> > done;
+  done.reserve(chunk_num);
+  for(unsigned i = 0; i < chunk_num; ++i)
+    done.push_back(pool.submit([&, i]{
+      chunk_tokens[i].reserve((bounds[i + 1] - bounds[i]) / 4);
+      auto res = chunks[i].lex_chunk(chunk_tokens[i]);
+      if(res.is_err()) errors[i].emplace(res.unwrap_err());
+    }));
+  for(auto& chunk_done: done) chunk_done.wait();
+
+  // Stitch chunks in source order: every chunk lexer counted lines and
+  // columns from (1, 1), and interned identifiers into its own table.
+  std::size_t total = 0;
+  for(auto& tokens: chunk_tokens) total += tokens.size();
+  lexed.reserve(total);
+
+  utils::Pos base{1, 1};
+  auto rebase = [&base](utils::Pos pos){
+    if(pos.line == 1) pos.col += base.col - 1;
+    pos.line += base.line - 1;
+    return pos;
+  };
+  std::vector<std::uint32_t> remap;
+  for(unsigned i = 0; i < chunk_num; ++i){
+    if(errors[i]){
+      errors[i]->pos = rebase(errors[i]->pos);
+      err_handler(*errors[i]);
+    }
+    auto const& local = chunks[i].interner;
+    remap.resize(local.size());
+    for(std::uint32_t id = keyword_count; id < local.size(); ++id)
+      remap[id] = interner.intern(local.spelling(id), local.hash_of(id));
+    for(auto& token: chunk_tokens[i]){
+      token.pos = rebase(token.pos);
+      if(token.is_ident()) token.ident_id = remap[token.ident_id];
+      lexed.push_back(token);
+    }
+    std::vector<Token>().swap(chunk_tokens[i]);
+    base = rebase({chunks[i].col, chunks[i].line});
+  }
+  col = base.col;
+  line = base.line;
+  is_pre_lexed = true;
 }
 
-std::vector<Token>&
-Lexer::get_tokens_out(){
-  return tokens;
+void
+Lexer::start_pipeline(){
+  assert(!is_pre_lexed && !ring_count);
+  pipeline = std::make_unique<Pipeline>();
+  pipeline->thread = std::thread(&Lexer::produce, this);
+}
+
+void
+Lexer::produce(){
+  Token batch[pipeline_batch];
+  unsigned count = 0;
+  bool more = true;
+  while(more){
+    Token& token = batch[count++];
+    auto res = lex_one_token(token);
+    if(res.is_err()){
+      pipeline->error.emplace(res.unwrap_err());
+      more = false;
+    }else more = res.unwrap();
+    if(!more){
+      token.init();
+      token.pos = {col, line};
+    }
+    if(count < pipeline_batch && more) continue;
+
+    std::size_t sent = 0;
+    while(sent < count){
+      sent += pipeline->queue.push(batch + sent, count - sent);
+      if(sent == count) break;
+      if(pipeline->cancelled.load(std::memory_order_relaxed)) return;
+      std::this_thread::yield();
+    }
+    count = 0;
+  }
+}
+
+void
+Lexer::receive(){
+  lexed.resize(pipeline_batch);
+  std::size_t count;
+  while(!(count = pipeline->queue.pop(lexed.data(), pipeline_batch)))
+    std::this_thread::yield();
+  lexed.resize(count);
+  lexed_pos = 0;
 }
 
 std::string
@@ -209,9 +398,13 @@ LexerError::to_string()const{
 }
 
 void 
-Lexer::display_all_tokens()const{
-  for(auto i = 0; i < tok_pos; ++i)
-      fprintf(stdout, "%s\n", tokens[i].fmt()->c_str());
+Lexer::display_all_tokens(){
+  utils::Sink out(stdout);
+  while(!peek().is(TokenType::unknown)){
+    peek().dump(out);
+    out << '\n';
+    consume();
+  }
 }
 
 }
\ No newline at end of file
@@ -1,12 +1,30 @@
 #include <fstream>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <optional>
+#include "arena.h"
+#include "baseline.h"
+#include "buffer.h"
+#include "cfg.h"
+#include "codegen.h"
+#include "inliner.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "tacky.h"
+#include "thread_pool.h"
 
 namespace{
 struct Args{
   int mode;
   char const* src_file_name;
   char const* out_file_name;
+  unsigned lex_jobs;
+  unsigned jobs;
+  unsigned inline_budget;
+  bool pipeline;
+  bool baseline;
 };
 }
 
@@ -20,6 +38,11 @@ parse_args(int argc, char const** argv){
   char const* src_file_name = argv[1];
   int mode = 0;
   char const* out_file_name = 0;
+  unsigned lex_jobs = 1;
+  unsigned jobs = 1;
+  unsigned inline_budget = niubcc::ir::default_inline_budget;
+  bool pipeline = false;
+  bool baseline = false;
   
   for(int i = 2; i < argc; ++i)
     if(strcmp(argv[i], "--lex") == 0)
@@ -28,6 +51,11 @@ parse_args(int argc, char const** argv){
       mode |= (0x1 << 1);
     else if(strcmp(argv[i], "--codegen") == 0)
       mode |= (0x1 << 2);
+    else if(strcmp(argv[i], "--tacky") == 0)
+      mode |= (0x1 << 3);
+    // Print the basic blocks of each function instead of the TACKY list.
+    else if(strcmp(argv[i], "--cfg") == 0)
+      mode |= (0x1 << 3) | (0x1 << 4);
     else if(strcmp(argv[i], "-o") == 0){
       if(i == argc - 1){
         fprintf(stderr, "No argument for -o.");
@@ -36,15 +64,118 @@ parse_args(int argc, char const** argv){
       out_file_name = argv[i + 1];
       ++i;
     }
+    // Lex the input concurrently on N threads, 0 for all hardware threads.
+    else if(strcmp(argv[i], "--lex-jobs") == 0){
+      if(i == argc - 1){
+        fprintf(stderr, "No argument for --lex-jobs.");
+        exit(1);
+      }
+      lex_jobs = static_cast<unsigned>(std::strtoul(argv[i + 1], 0, 10));
+      ++i;
+    }
+    // Lower and generate functions on N threads, 0 for all hardware threads.
+    else if(strcmp(argv[i], "--jobs") == 0){
+      if(i == argc - 1){
+        fprintf(stderr, "No argument for --jobs.");
+        exit(1);
+      }
+      jobs = static_cast<unsigned>(std::strtoul(argv[i + 1], 0, 10));
+      ++i;
+    }
+    // Instructions inlining may add to each function, 0 to not inline.
+    else if(strcmp(argv[i], "--inline-budget") == 0){
+      if(i == argc - 1){
+        fprintf(stderr, "No argument for --inline-budget.");
+        exit(1);
+      }
+      inline_budget = static_cast<unsigned>(std::strtoul(argv[i + 1], 0, 10));
+      ++i;
+    }
+    // Run the lexer on its own thread, feeding the parser as it goes.
+    else if(strcmp(argv[i], "--pipeline") == 0)
+      pipeline = true;
+    // Generate straight from the AST, skipping TACKY and its passes.
+    else if(strcmp(argv[i], "-O0") == 0)
+      baseline = true;
     else{
       fprintf(stderr, "Unrecognized argument %s", argv[i]);
       exit(1);
     }
   
-  return Args{mode, src_file_name, out_file_name};
+  return Args{mode, src_file_name, out_file_name, lex_jobs, jobs, inline_budget, pipeline, baseline};
 }
 
 int
 main(int argc, char const** argv){
   Args args = parse_args(argc, argv);
-}
\ No newline at end of file
+
+  auto buffer_res = niubcc::Buffer::from_file(args.src_file_name);
+  if(buffer_res.is_err()){
+    buffer_res.handle_err([](niubcc::BufferError const& err){
+      auto msg = err.to_string();
+      std::fwrite(msg.data(), 1, msg.size(), stderr);
+    });
+    return 1;
+  }
+  auto buffer = buffer_res.unwrap();
+
+  niubcc::Lexer lexer(buffer.get_start());
+  std::optional<niubcc::ThreadPool> pool;
+  if(args.lex_jobs != 1){
+    pool.emplace(args.lex_jobs);
+    lexer.tokenize_parallel(*pool, buffer.get_length());
+  }else if(args.pipeline)
+    lexer.start_pipeline();
+  if(args.mode & 0x1){
+    lexer.display_all_tokens();
+    return 0;
+  }
+
+  niubcc::Arena arena;
+  niubcc::Parser parser(lexer, arena);
+  auto program = parser.parse();
+  if(args.mode & (0x1 << 1)){
+    niubcc::utils::Sink out(stdout);
+    program->dump(out);
+    out << '\n';
+    return 0;
+  }
+
+  if(args.baseline && !(args.mode & (0x1 << 3))){
+    niubcc::codegen::BaselineGenerator generator;
+    generator.generate(program);
+    if(args.mode & (0x1 << 2)) return 0;
+    generator.emie_code(args.out_file_name ? args.out_file_name : "a.s");
+    return 0;
+  }
+
+  niubcc::codegen::AsmGenerator generator;
+  if(args.jobs != 1 && !(args.mode & (0x1 << 3))){
+    niubcc::ThreadPool backend_pool(args.jobs);
+    generator.generate_parallel(program, backend_pool, args.inline_budget);
+  }else{
+    niubcc::ir::AstBuilder builder;
+    auto ir = builder.build(program);
+    // -O0 with --tacky shows the TACKY as lowered.
+    if(!args.baseline){
+      niubcc::ir::inline_calls(ir.get(), args.inline_budget);
+      for(auto& funcdef: ir->funcdefs)
+        niubcc::ir::optimize(funcdef);
+    }
+    if(args.mode & (0x1 << 4)){
+      niubcc::utils::Sink out(stdout);
+      for(auto& funcdef: ir->funcdefs)
+        niubcc::ir::Cfg::build(funcdef).dump(out, funcdef);
+      return 0;
+    }
+    if(args.mode & (0x1 << 3)){
+      niubcc::utils::Sink out(stdout);
+      ir->dump(out);
+      return 0;
+    }
+    generator.generate(ir.get());
+  }
+  if(args.mode & (0x1 << 2)) return 0;
+
+  generator.emie_code(args.out_file_name ? args.out_file_name : "a.s");
+}
@@ -0,0 +1,24 @@
+#include "optimizer.h"
+
+namespace niubcc{
+namespace ir{
+
+namespace{
+// Each round can expose work for the others; stop after this many even
+// if they still find some.
+constexpr unsigned max_rounds = 16;
+}
+
+void
+optimize(FunctionDef& fn){
+  for(unsigned round = 0; round < max_rounds; ++round){
+    bool changed = fold_constants(fn);
+    changed |= propagate_copies(fn);
+    changed |= eliminate_dead_code(fn);
+    changed |= simplify_cfg(fn);
+    if(!changed) break;
+  }
+}
+
+}
+}
@@ -1,4 +1,5 @@
 #include "parser.h"
+#include "optimizer.h"
 #include "utils.h"
 #include <cassert>
 
@@ -59,19 +60,16 @@ Parser::convert_token_to_op(TokenType tokentype)const{
 #undef TOK
 #undef OP
 
-Parser::Parser(Lexer& lexer){
-  tok_pos = 0;
-  tokens.swap(lexer.get_tokens_out());
-}
+Parser::Parser(Lexer& lexer, Arena& arena): lexer(lexer), arena(arena){}
 
 bool
 Parser::match(TokenType type){
-  if(!tokens[tok_pos].is(type)) return false;
-  ++tok_pos;
+  if(!lexer.peek().is(type)) return false;
+  lexer.consume();
   return true;
 }
 
-Ptr<ast::Program>
+ast::Program*
 Parser::parse(){
   auto res = parse_program();
   if(res.is_err()) res.handle_err(Parser::error_handler);
@@ -79,71 +77,109 @@ Parser::parse(){
   return root;
 }
 
-Expected<Ptr<ast::Program>, ParseError>
+// Program -> FunctionDef*
+Expected<ast::Program*, ParseError>
 Parser::parse_program(){
-  auto res = parse_funcdef();
-  if(res.is_err()) return res.unwrap_err();
-  return std::make_shared<ast::Program>(res.unwrap());
+  std::vector<ast::FunctionDef*> funcdefs;
+  while(!next_is(TokenType::unknown)){
+    auto res = parse_funcdef();
+    if(res.is_err()) return res.unwrap_err();
+    // Declarations only reach the symbol table.
+    if(auto funcdef = res.unwrap()) funcdefs.push_back(funcdef);
+  }
+  return arena.make<ast::Program>(arena.make_array(funcdefs));
 }
 
-Expected<Ptr<ast::FunctionDef>, ParseError>
+Expected<ast::FunctionDef*, ParseError>
 Parser::parse_funcdef(){
   if(!match(TokenType::kw_int))
     return ParseError("Expected keyword int", get_cur_tok_pos());
 
   if(!match(TokenType::ident))
     return ParseError("Expected function name", get_cur_tok_pos());
-  char const* name = tokens[tok_pos - 1].get_name();
-  unsigned name_len = tokens[tok_pos - 1].get_name_len();
+  char const* name = lexer.last().get_name();
+  unsigned name_len = lexer.last().get_name_len();
+  auto id = lexer.last().get_ident_id();
 
-  if(!match(TokenType::lparen, TokenType::rparen, TokenType::punct_lbrace))
+  if(!match(TokenType::lparen))
     return ParseError("Syntax error", get_cur_tok_pos());
 
+  // Parameters are bound in the scope of the body's outermost block, so
+  // the body cannot redeclare them.
   symbol_table.call_func();
+  symbol_table.enter_scope();
+  std::vector<ast::Var*> params;
+  if(!match(TokenType::kw_void) && !next_is(TokenType::rparen)){
+    do{
+      if(!match(TokenType::kw_int))
+        return ParseError("Expected keyword int", get_cur_tok_pos());
+      if(!match(TokenType::ident))
+        return ParseError("Expected parameter name", get_cur_tok_pos());
+      auto slot = symbol_table.lookup_and_add(lexer.last().get_ident_id());
+      if(!slot)
+        return ParseError("Redefinition of parameter", get_cur_tok_pos());
+      params.push_back(arena.make<ast::Var>(lexer.last().get_name(),
+        lexer.last().get_name_len(), *slot));
+    }while(match(TokenType::punct_comma));
+  }
+  if(!match(TokenType::rparen))
+    return ParseError("Expected )", get_cur_tok_pos());
 
-  auto body = parse_compoundstmt();
-  if(body.is_err()) return body.unwrap_err();
+  auto& function = symbol_table.add_function(id, params.size());
+  if(function.param_count != params.size())
+    return ParseError("Conflicting types for function", get_cur_tok_pos());
 
-  if(!next_is(TokenType::unknown)){
-    return ParseError("Only support one main function defination",
-      get_cur_tok_pos());
+  if(match(TokenType::punct_semicol)){
+    symbol_table.leave_scope();
+    symbol_table.ret_func();
+    return static_cast<ast::FunctionDef*>(0);
   }
 
+  if(function.is_defined)
+    return ParseError("Redefinition of function", get_cur_tok_pos());
+  // Defined before the body, so the function can call itself.
+  function.is_defined = true;
+
+  if(!match(TokenType::punct_lbrace))
+    return ParseError("Syntax error", get_cur_tok_pos());
+
+  auto body = parse_compoundstmt(false);
+  if(body.is_err()) return body.unwrap_err();
+  symbol_table.leave_scope();
+
   auto check_label = symbol_table.resolve_all_labels();
   if(check_label.has_value()){
     return ParseError("Use of undefined label", check_label.value());
   }
 
+  auto var_count = symbol_table.get_var_count();
   symbol_table.ret_func();
 
-  return std::make_shared<ast::FunctionDef>(name, name_len, body.unwrap());
+  return arena.make<ast::FunctionDef>(name, name_len, arena.make_array(params), body.unwrap(),
+    var_count);
 }
 
-Expected<Ptr<ast::Block>, ParseError>
+Expected<ast::Block*, ParseError>
 Parser::parse_block(){
   // Declaration
   if(next_is(TokenType::kw_int)){
     auto decl = parse_decl();
     if(decl.is_err()) return decl.unwrap_err();
-    return std::shared_ptr<ast::Block>(decl.unwrap());
+    return decl.unwrap();
   }
-  // Why use std::shared_ptr<ast::Block>() instead of std::make_shared<ast::Block>() ?
-  // 1. ast::Block is an abstract class, which could not be constructed.
-  // 2. Even if ast::Block is not abtract, in some compiler or context it may not compile
-  //    This is because decl.unwrap() is a rvalue and sometimes compiler will not choose to apply implict conversion.
 
   // Statement
   if(!next_is(TokenType::punct_rbrace)){
     auto stmt = parse_stmt();
     if(stmt.is_err()) return stmt.unwrap_err();
-    return std::shared_ptr<ast::Block>(stmt.unwrap());
+    return stmt.unwrap();
   }
 
   // Empty. e.g., int main(){}
-  return std::shared_ptr<ast::Block>(0);
+  return static_cast<ast::Block*>(0);
 }
 
-Expected<Ptr<ast::Decl>, ParseError>
+Expected<ast::Decl*, ParseError>
 Parser::parse_decl(){
   if(!match(TokenType::kw_int))
     return ParseError("Expected type specifier, for now it is int", get_cur_tok_pos());
@@ -151,7 +187,7 @@ Parser::parse_decl(){
   auto res = parse_decl_init_list();
   if(res.is_err()) return res.unwrap_err();
   auto decl = res.unwrap();
-  Ptr<ast::Block> cur = decl;
+  ast::Block* cur = decl;
 
   while(match(TokenType::punct_comma)){
     auto res = parse_decl_init_list();
@@ -166,17 +202,17 @@ Parser::parse_decl(){
   return decl;
 }
 
-Expected<Ptr<ast::Decl>, ParseError>
+Expected<ast::Decl*, ParseError>
 Parser::parse_decl_init_list(){
   if(!match(TokenType::ident))
     return ParseError("Expected variable name", get_cur_tok_pos());
 
-  char const* name = tokens[tok_pos - 1].get_name();
-  unsigned len = tokens[tok_pos - 1].get_name_len();
-  auto uniq_name = symbol_table.lookup_and_add(name, len);
-  if(!uniq_name) return ParseError("Duplicate declaration", get_cur_tok_pos());
+  char const* name = lexer.last().get_name();
+  unsigned len = lexer.last().get_name_len();
+  auto slot = symbol_table.lookup_and_add(lexer.last().get_ident_id());
+  if(!slot) return ParseError("Duplicate declaration", get_cur_tok_pos());
 
-  auto decl = std::make_shared<ast::Decl>(uniq_name);
+  auto decl = arena.make<ast::Decl>(name, len, *slot);
   if(match(TokenType::op_assign)){
     auto init = parse_expr();
     if(init.is_err()) return init.unwrap_err();
@@ -186,75 +222,87 @@ Parser::parse_decl_init_list(){
   return decl;
 }
 
-Expected<Ptr<ast::Stmt>, ParseError>
+Expected<ast::Stmt*, ParseError>
 Parser::parse_stmt(){
-  if(next_is(TokenType::ident) && tokens[tok_pos + 1].get_type() == TokenType::punct_colon){
+  if(next_is(TokenType::ident) && lexer.peek(1).is(TokenType::punct_colon)){
     if(!symbol_table.is_in_func())
       return ParseError("Can only define lable in functions", get_cur_tok_pos());
-    char const* name = tokens[tok_pos].get_name();
-    unsigned len = tokens[tok_pos].get_name_len();
-    auto label_name = symbol_table.define_label(name, len, get_cur_tok_pos());
-    if(!label_name) return ParseError("Redifine label", get_cur_tok_pos());
-    tok_pos += 2;
+    char const* name = lexer.peek().get_name();
+    unsigned len = lexer.peek().get_name_len();
+    auto number = symbol_table.define_label(lexer.peek().get_ident_id(), get_cur_tok_pos());
+    if(!number) return ParseError("Redifine label", get_cur_tok_pos());
+    lexer.consume();
+    lexer.consume();
     auto res = parse_stmt();
     if(res.is_err()) return res.unwrap_err();
     auto stmt = res.unwrap();
-    stmt->label = label_name;
+    stmt->label = ast::UserLabel{name, len, *number};
     return stmt;
   }
   if(match(TokenType::kw_ret)){
     auto res = parse_retstmt();
     if(res.is_err()) return res.unwrap_err();
-    return std::shared_ptr<ast::Stmt>(res.unwrap());
+    return res.unwrap();
   }
   if(match(TokenType::kw_if)){
     auto res = parse_ifstmt();
     if(res.is_err()) return res.unwrap_err();
-    return std::shared_ptr<ast::Stmt>(res.unwrap());
+    return res.unwrap();
   }
   if(match(TokenType::kw_do)){
     auto res = parse_dostmt();
     if(res.is_err()) return res.unwrap_err();
-    return std::shared_ptr<ast::Stmt>(res.unwrap());
+    return res.unwrap();
   }
   if(match(TokenType::kw_while)){
     auto res = parse_whilestmt();
     if(res.is_err()) return res.unwrap_err();
-    return std::shared_ptr<ast::Stmt>(res.unwrap());
+    return res.unwrap();
   }
   if(match(TokenType::kw_for)){
     auto res = parse_forstmt();
     if(res.is_err()) return res.unwrap_err();
-    return std::shared_ptr<ast::Stmt>(res.unwrap());
+    return res.unwrap();
   }
   if(match(TokenType::kw_goto)){
     auto res = parse_gotostmt();
     if(res.is_err()) return res.unwrap_err();
-    return std::shared_ptr<ast::Stmt>(res.unwrap());
+    return res.unwrap();
+  }
+  if(match(TokenType::kw_switch)){
+    auto res = parse_switchstmt();
+    if(res.is_err()) return res.unwrap_err();
+    return res.unwrap();
+  }
+  if(next_is(TokenType::kw_case, TokenType::kw_default)){
+    auto res = parse_casestmt(next_is(TokenType::kw_default));
+    if(res.is_err()) return res.unwrap_err();
+    return res.unwrap();
   }
   if(match(TokenType::kw_break)){
-    if(!loop_depth) return ParseError("Break statement outside loop", get_cur_tok_pos());
+    if(!loop_depth && switches.empty())
+      return ParseError("Break statement outside loop or switch", get_cur_tok_pos());
     if(!match(TokenType::punct_semicol)) return ParseError("Expected semicolumn", get_cur_tok_pos());
-    return std::shared_ptr<ast::Stmt>(std::make_shared<ast::Break>());
+    return arena.make<ast::Break>();
   }
   if(match(TokenType::kw_continue)){
     if(!loop_depth) return ParseError("Contiue statement outside loop", get_cur_tok_pos());
     if(!match(TokenType::punct_semicol)) return ParseError("Expected semicolumn", get_cur_tok_pos());
-    return std::shared_ptr<ast::Stmt>(std::make_shared<ast::Continue>());
+    return arena.make<ast::Continue>();
   }
   if(match(TokenType::punct_semicol))
-    return std::shared_ptr<ast::Stmt>(std::make_shared<ast::NullStmt>());
+    return arena.make<ast::NullStmt>();
   if(match(TokenType::punct_lbrace)){
     auto res = parse_compoundstmt();
     if(res.is_err()) return res.unwrap_err();
-    return std::shared_ptr<ast::Stmt>(res.unwrap());
+    return res.unwrap();
   }
   auto res = parse_exprstmt();
   if(res.is_err()) return res.unwrap_err();
-  return std::shared_ptr<ast::Stmt>(res.unwrap());
+  return res.unwrap();
 }
 
-Expected<Ptr<ast::DoStmt>, ParseError>
+Expected<ast::DoStmt*, ParseError>
 Parser::parse_dostmt(){
   ++loop_depth;
   auto stmt = parse_stmt();
@@ -276,10 +324,10 @@ Parser::parse_dostmt(){
     return ParseError("Expected semicoloum", get_cur_tok_pos());
   
   --loop_depth;
-  return std::make_shared<ast::DoStmt>(stmt.unwrap(), condition.unwrap());
+  return arena.make<ast::DoStmt>(stmt.unwrap(), condition.unwrap());
 };
 
-Expected<Ptr<ast::WhileStmt>, ParseError>
+Expected<ast::WhileStmt*, ParseError>
 Parser::parse_whilestmt(){
   if(!match(TokenType::lparen))
     return ParseError("Expected left paranthesis", get_cur_tok_pos());
@@ -294,10 +342,10 @@ Parser::parse_whilestmt(){
   auto stmt = parse_stmt();
   if(stmt.is_err()) return stmt.unwrap_err();
   --loop_depth;
-  return std::make_shared<ast::WhileStmt>(stmt.unwrap(), condition.unwrap());
+  return arena.make<ast::WhileStmt>(stmt.unwrap(), condition.unwrap());
 };
 
-Expected<Ptr<ast::ForStmt>, ParseError>
+Expected<ast::ForStmt*, ParseError>
 Parser::parse_forstmt(){
   if(!match(TokenType::lparen))
     return ParseError("Expected left paranthesis", get_cur_tok_pos());
@@ -307,8 +355,8 @@ Parser::parse_forstmt(){
   auto init = parse_forinit();
   if(init.is_err()) return init.unwrap_err();
 
-  Ptr<ast::Expr> condition = 0;
-  Ptr<ast::Expr> post = 0;
+  ast::Expr* condition = 0;
+  ast::Expr* post = 0;
 
   if(!match(TokenType::punct_semicol)){
     auto res = parse_expr();
@@ -333,65 +381,205 @@ Parser::parse_forstmt(){
   --loop_depth;
 
   symbol_table.leave_scope();
-  return std::make_shared<ast::ForStmt>(init.unwrap(), condition, post, stmt.unwrap());
+  return arena.make<ast::ForStmt>(init.unwrap(), condition, post, stmt.unwrap());
 };
 
-Expected<Ptr<ast::ForStmtInit>, ParseError>
+Expected<ast::ForStmtInit*, ParseError>
 Parser::parse_forinit(){
   if(next_is(TokenType::kw_int)){
     auto res = parse_decl();
     if(res.is_err()) return res.unwrap_err();
-    return std::make_shared<ast::ForStmtInit>(res.unwrap());
+    return arena.make<ast::ForStmtInit>(res.unwrap());
   }
   if(next_is(TokenType::punct_semicol))
-    return std::shared_ptr<ast::ForStmtInit>(0);
+    return static_cast<ast::ForStmtInit*>(0);
   auto res = parse_expr();
   if(res.is_err()) return res.unwrap_err();
   if(!match(TokenType::punct_semicol))
     return ParseError("Expected semicolumn", get_cur_tok_pos());
-  return std::make_shared<ast::ForStmtInit>(res.unwrap());
+  return arena.make<ast::ForStmtInit>(res.unwrap());
 }
 
-Expected<Ptr<ast::GotoStmt>, ParseError>
+Expected<ast::GotoStmt*, ParseError>
 Parser::parse_gotostmt(){
   if(!match(TokenType::ident))
     return ParseError("Expected label name", get_cur_tok_pos());
-  char const* name = tokens[tok_pos - 1].get_name();
-  unsigned len = tokens[tok_pos - 1].get_name_len();
-  auto label_name = symbol_table.add_label(name, len, get_cur_tok_pos());
+  char const* name = lexer.last().get_name();
+  unsigned len = lexer.last().get_name_len();
+  auto number = symbol_table.add_label(lexer.last().get_ident_id(), get_cur_tok_pos());
   if(!match(TokenType::punct_semicol))
     return ParseError("Expected semicolumn", get_cur_tok_pos());
-  return std::make_shared<ast::GotoStmt>(label_name);
+  return arena.make<ast::GotoStmt>(ast::UserLabel{name, len, number});
 }
 
-Expected<Ptr<ast::CompoundStmt>, ParseError>
-Parser::parse_compoundstmt(){
-  symbol_table.enter_scope();
+// Value of an integer constant expression: literals under unary, binary
+// and conditional operators, folded as the TACKY constant folder does.
+// The operands that &&, || and ?: skip are not evaluated, as at run
+// time. Walked in post order with an explicit stack, like lowering.
+static std::optional<std::int64_t>
+constant_value(ast::Expr* root){
+  struct Frame{
+    ast::Expr* node{0};
+    unsigned stage{0};
+  };
+  std::vector<Frame> frames{{root}};
+  std::vector<std::int32_t> vals;
+
+  auto pop_val = [&vals](){
+    auto val = vals.back();
+    vals.pop_back();
+    return val;
+  };
+  auto done = [&frames, &vals](std::int32_t res){
+    frames.pop_back();
+    vals.push_back(res);
+  };
+  auto visit = [&frames](ast::Expr* node){
+    frames.push_back({node});
+  };
+
+  while(!frames.empty()){
+    auto& frame = frames.back();
+    switch(auto node = frame.node; node->kind){
+      case ast::Kind::Constant:
+        done(static_cast<ast::Constant*>(node)->value);
+        break;
+
+      case ast::Kind::Unary:{
+        auto p = static_cast<ast::Unary*>(node);
+        if(frame.stage++ == 0){
+          visit(p->expr);
+          break;
+        }
+        auto res = ir::fold_unary(p->op_type, pop_val());
+        if(!res) return std::nullopt;
+        done(*res);
+        break;
+      }
+
+      case ast::Kind::Binary:{
+        auto p = static_cast<ast::Binary*>(node);
+        if(p->op_type == ast::OpType::op_and || p->op_type == ast::OpType::op_or){
+          bool is_and = p->op_type == ast::OpType::op_and;
+          switch(frame.stage++){
+            case 0: visit(p->lhs); break;
+            case 1:
+              if((pop_val() != 0) != is_and) done(!is_and);
+              else visit(p->rhs);
+              break;
+            default: done(pop_val() != 0);
+          }
+          break;
+        }
+        switch(frame.stage++){
+          case 0: visit(p->lhs); break;
+          case 1: visit(p->rhs); break;
+          default:{
+            auto rhs = pop_val();
+            auto lhs = pop_val();
+            auto res = ir::fold_binary(p->op_type, lhs, rhs);
+            if(!res) return std::nullopt;
+            done(*res);
+          }
+        }
+        break;
+      }
+
+      case ast::Kind::Condition:{
+        auto p = static_cast<ast::Condition*>(node);
+        switch(frame.stage++){
+          case 0: visit(p->condition); break;
+          case 1: visit(pop_val() ? p->true_val : p->false_val); break;
+          default: done(pop_val());
+        }
+        break;
+      }
+
+      default:
+        return std::nullopt;
+    }
+  }
+  return vals.back();
+}
+
+Expected<ast::SwitchStmt*, ParseError>
+Parser::parse_switchstmt(){
+  if(!match(TokenType::lparen))
+    return ParseError("Expected left paranthesis", get_cur_tok_pos());
+  auto condition = parse_expr();
+  if(condition.is_err()) return condition.unwrap_err();
+  if(!match(TokenType::rparen))
+    return ParseError("Expected right paranthesis", get_cur_tok_pos());
+
+  auto node = arena.make<ast::SwitchStmt>(condition.unwrap());
+  switches.push_back({node});
+  auto body = parse_stmt();
+  node->cases = arena.make_array(switches.back().cases);
+  switches.pop_back();
+  if(body.is_err()) return body.unwrap_err();
+  node->body = body.unwrap();
+  return node;
+}
+
+// CaseStmt -> case Const : Stmt | default : Stmt
+Expected<ast::CaseStmt*, ParseError>
+Parser::parse_casestmt(bool is_default){
+  lexer.consume();
+  if(switches.empty())
+    return ParseError("Case label outside switch", get_cur_tok_pos());
+  auto& context = switches.back();
+
+  std::int64_t value = 0;
+  if(is_default){
+    if(context.has_default)
+      return ParseError("Multiple default labels in one switch", get_cur_tok_pos());
+    context.has_default = true;
+  }else{
+    auto expr = parse_expr();
+    if(expr.is_err()) return expr.unwrap_err();
+    auto constant = constant_value(expr.unwrap());
+    if(!constant)
+      return ParseError("Case label is not an integer constant", get_cur_tok_pos());
+    value = *constant;
+    if(!context.values.insert(value).second)
+      return ParseError("Duplicate case value", get_cur_tok_pos());
+  }
+  if(!match(TokenType::punct_colon))
+    return ParseError("Expected colon after case label", get_cur_tok_pos());
+
+  // Listed before the statement, so that cases keep source order.
+  auto node = arena.make<ast::CaseStmt>(value, is_default, context.cases.size());
+  context.cases.push_back(node);
+  auto stmt = parse_stmt();
+  if(stmt.is_err()) return stmt.unwrap_err();
+  node->stmt = stmt.unwrap();
+  return node;
+}
+
+Expected<ast::CompoundStmt*, ParseError>
+Parser::parse_compoundstmt(bool new_scope){
+  if(new_scope) symbol_table.enter_scope();
 
   auto blocks_res = parse_block();
   // parse_block() return null ptr if the body is empty, e.g., int main(){}
   if(blocks_res.is_err()) return blocks_res.unwrap_err();
   auto blocks = blocks_res.unwrap();
-  auto cur = blocks;
-  while(cur->next) cur = cur->next;
-
-  while(1){
+  for(auto cur = blocks; cur; cur = cur->next){
+    while(cur->next) cur = cur->next;
     auto res = parse_block();
     if(res.is_err()) return res.unwrap_err();
-    cur->next = res.unwrap(); 
-    if(!cur->next) break;
-    while(cur->next) cur = cur->next;
+    cur->next = res.unwrap();
   }
 
   // Checking the closed right brace
   if(!match(TokenType::punct_rbrace))
     return ParseError("Expected right brace after function body", get_cur_tok_pos());
 
-  symbol_table.leave_scope();
-  return std::make_shared<ast::CompoundStmt>(blocks);
+  if(new_scope) symbol_table.leave_scope();
+  return arena.make<ast::CompoundStmt>(blocks);
 }
 
-Expected<Ptr<ast::IfStmt>, ParseError>
+Expected<ast::IfStmt*, ParseError>
 Parser::parse_ifstmt(){
   if(!match(TokenType::lparen))
     return ParseError("Expected left paranthesis", get_cur_tok_pos());
@@ -404,26 +592,26 @@ Parser::parse_ifstmt(){
 
   auto then_stmt = parse_stmt();
   if(then_stmt.is_err()) return then_stmt.unwrap_err();
-  Ptr<ast::Stmt> else_stmt = 0;
+  ast::Stmt* else_stmt = 0;
   if(match(TokenType::kw_else)){
     auto res = parse_stmt();
     if(res.is_err()) return res.unwrap_err();
     else_stmt = res.unwrap();
   }
-  return std::make_shared<ast::IfStmt>(condition.unwrap(), then_stmt.unwrap(), else_stmt);
+  return arena.make<ast::IfStmt>(condition.unwrap(), then_stmt.unwrap(), else_stmt);
 }
 
-Expected<Ptr<ast::ExprStmt>, ParseError>
+Expected<ast::ExprStmt*, ParseError>
 Parser::parse_exprstmt(){
   auto expr = parse_expr();
   if(expr.is_err()) return expr.unwrap_err();
   if(!match(TokenType::punct_semicol))
     return ParseError("Expected semicolumn", get_cur_tok_pos());
-  return std::make_shared<ast::ExprStmt>(expr.unwrap());
+  return arena.make<ast::ExprStmt>(expr.unwrap());
 }
 
 // Stmt -> return Expr ;
-Expected<Ptr<ast::RetStmt>, ParseError>
+Expected<ast::RetStmt*, ParseError>
 Parser::parse_retstmt(){
   auto expr = parse_expr();
   if(expr.is_err()) return expr.unwrap_err();
@@ -432,99 +620,160 @@ Parser::parse_retstmt(){
     return ParseError("Expected semicolumn",
       get_cur_tok_pos());
 
-  return std::make_shared<ast::RetStmt>(expr.unwrap());
+  return arena.make<ast::RetStmt>(expr.unwrap());
 }
 
 // Expr -> Factor | Expr op Expr
-Expected<Ptr<ast::Expr>, ParseError>
+// Precedence climbing without recursion: where the recursive form would
+// call itself for an operand, push a frame and continue with the operand;
+// when an operand is complete, pop the frame and build its node.
+Expected<ast::Expr*, ParseError>
 Parser::parse_expr(unsigned precedence){
-  auto lhs_res = parse_factor();
-  if(lhs_res.is_err()) return lhs_res.unwrap_err();
-
-  ast::OpType op;
-  Ptr<ast::Expr> lhs = lhs_res.unwrap();
-
-  while(is_next_binary_op() && get_op_precedence(get_cur_tok_type()) >= precedence){
-    if(match(TokenType::op_assign)){
-      if(!std::dynamic_pointer_cast<ast::Var>(lhs))
-        return ParseError("Cannot assign to a rvalue", get_cur_tok_pos());
-      auto rhs = parse_expr(get_op_precedence(ast::OpType::op_assign));
-      lhs = std::make_shared<ast::Assign>(rhs.unwrap(), lhs);
-    }else if(match(TokenType::op_que)){
-      auto mid = parse_condition();
-      if(mid.is_err()) return mid.unwrap_err();
-      auto rhs = parse_expr(get_op_precedence(ast::OpType::op_que));
-      if(rhs.is_err()) return rhs.unwrap_err();
-      lhs = std::make_shared<ast::Condition>(lhs, mid.unwrap(), rhs.unwrap());
-    }else{
-      op = convert_token_to_op(get_cur_tok_type());
-      ++tok_pos;
-      auto rhs = parse_expr(get_op_precedence(op) + 1);
-      if(rhs.is_err()) return rhs.unwrap_err();
-      lhs = std::make_shared<ast::Binary>(op, lhs, rhs.unwrap());
+  using Type = ExprFrame::Type;
+  auto base = expr_frames.size();
+  auto fail = [this, base](ParseError err){
+    expr_frames.resize(base);
+    return err;
+  };
+
+  while(1){
+    auto factor = parse_factor(precedence);
+    if(factor.is_err()) return fail(factor.unwrap_err());
+    auto expr = factor.unwrap();
+
+    // Reduce until an operator needs another operand.
+    bool need_operand = false;
+    while(!need_operand){
+      while(expr_frames.size() > base && expr_frames.back().type == Type::Unary){
+        expr = arena.make<ast::Unary>(expr_frames.back().op, expr);
+        expr_frames.pop_back();
+      }
+
+      if(is_next_binary_op() && get_op_precedence(get_cur_tok_type()) >= precedence){
+        need_operand = true;
+        if(match(TokenType::op_assign)){
+          if(expr->kind != ast::Kind::Var)
+            return fail(ParseError("Cannot assign to a rvalue", get_cur_tok_pos()));
+          expr_frames.push_back({Type::Assign, ast::OpType::op_assign, precedence, expr});
+          precedence = get_op_precedence(ast::OpType::op_assign);
+        }else if(match(TokenType::op_que)){
+          expr_frames.push_back({Type::CondTrue, ast::OpType::op_que, precedence, expr});
+          precedence = 0;
+        }else{
+          auto op = convert_token_to_op(get_cur_tok_type());
+          lexer.consume();
+          expr_frames.push_back({Type::Binary, op, precedence, expr});
+          precedence = get_op_precedence(op) + 1;
+        }
+        break;
+      }
+
+      if(expr_frames.size() == base) return expr;
+      auto frame = expr_frames.back();
+      expr_frames.pop_back();
+      precedence = frame.precedence;
+      switch(frame.type){
+        case Type::Paren:
+          if(!match(TokenType::rparen))
+            return fail(ParseError("Expected )", get_cur_tok_pos()));
+          break;
+        case Type::Binary:
+          expr = arena.make<ast::Binary>(frame.op, frame.lhs, expr);
+          break;
+        case Type::Assign:
+          expr = arena.make<ast::Assign>(expr, frame.lhs);
+          break;
+        case Type::CondTrue:
+          if(!match(TokenType::punct_colon))
+            return fail(ParseError("Expected colon in condition expression", get_cur_tok_pos()));
+          expr_frames.push_back({Type::CondFalse, frame.op, frame.precedence, frame.lhs, expr});
+          precedence = get_op_precedence(ast::OpType::op_que);
+          need_operand = true;
+          break;
+        case Type::CondFalse:
+          expr = arena.make<ast::Condition>(frame.lhs, frame.mid, expr);
+          break;
+        case Type::Call:{
+          auto call = static_cast<ast::Call*>(frame.lhs);
+          if(frame.arg_count == call->args.size())
+            return fail(ParseError("Wrong number of arguments", get_cur_tok_pos()));
+          call->args[frame.arg_count++] = expr;
+          if(match(TokenType::punct_comma)){
+            expr_frames.push_back(frame);
+            precedence = 0;
+            need_operand = true;
+            break;
+          }
+          if(!match(TokenType::rparen))
+            return fail(ParseError("Expected )", get_cur_tok_pos()));
+          if(frame.arg_count != call->args.size())
+            return fail(ParseError("Wrong number of arguments", get_cur_tok_pos()));
+          expr = call;
+          break;
+        }
+        case Type::Unary:
+          assert(0 && "unreachable");
+      }
     }
   }
-  return lhs;
-}
-
-Expected<Ptr<ast::Expr>, ParseError>
-Parser::parse_condition(unsigned precedence){
-  auto res = parse_expr();
-  if(res.is_err()) return res.unwrap_err();
-  if(!match(TokenType::punct_colon))
-    return ParseError("Expected colon in condition expression", get_cur_tok_pos());
-  return res.unwrap();
 }
 
-// Factor -> int | Unary | (Expr) | Var
-Expected<Ptr<ast::Expr>, ParseError>
-Parser::parse_factor(){
-  if(next_is(TokenType::op_decre))
-    return ParseError("We do not support decrement operator yet",
-      get_cur_tok_pos());
-  if(next_is(TokenType::op_incre))
-    return ParseError("We do not support increment operator yet",
-      get_cur_tok_pos());
-  if(is_next_unary_op()){
-    auto unary = parse_unary();
-    if(unary.is_err()) return unary.unwrap_err();
-    return std::shared_ptr<ast::Expr>(unary.unwrap());
-  }
-
-  if(match(TokenType::lparen)){
-    auto expr = parse_expr();
-    if(expr.is_err()) return expr.unwrap_err();
-    if(!match(TokenType::rparen))
-      return ParseError("Expected )", get_cur_tok_pos());
-    return expr;
-  }
-
-  if(match(TokenType::ident)){
-    auto uniq_name = symbol_table.lookup_and_get(
-      tokens[tok_pos - 1].get_name(), tokens[tok_pos - 1].get_name_len());
-    if(!uniq_name)
-      return ParseError("Undefined Variable", get_cur_tok_pos());
-    return std::shared_ptr<ast::Expr>(std::make_shared<ast::Var>(uniq_name));
+// Factor -> int | Unary | (Expr) | Var | Call
+// Unary -> - | ~ Factor
+// Call -> ident ( [Expr {, Expr}] )
+// Prefix operators and open parentheses only push frames for parse_expr
+// to close; this returns the innermost operand.
+Expected<ast::Expr*, ParseError>
+Parser::parse_factor(unsigned& precedence){
+  while(1){
+    if(next_is(TokenType::op_decre))
+      return ParseError("We do not support decrement operator yet",
+        get_cur_tok_pos());
+    if(next_is(TokenType::op_incre))
+      return ParseError("We do not support increment operator yet",
+        get_cur_tok_pos());
+    if(is_next_unary_op()){
+      auto op_type = convert_token_to_op(get_cur_tok_type());
+      lexer.consume();
+      expr_frames.push_back({ExprFrame::Type::Unary, op_type, precedence});
+    }else if(match(TokenType::lparen)){
+      expr_frames.push_back({ExprFrame::Type::Paren, ast::OpType{}, precedence});
+      precedence = 0;
+    }else if(match(TokenType::ident)){
+      auto id = lexer.last().get_ident_id();
+      auto name = lexer.last().get_name();
+      auto name_len = lexer.last().get_name_len();
+      if(!match(TokenType::lparen)){
+        auto slot = symbol_table.lookup_and_get(id);
+        if(!slot)
+          return ParseError("Undefined Variable", get_cur_tok_pos());
+        return arena.make<ast::Var>(name, name_len, *slot);
+      }
+
+      auto function = symbol_table.lookup_function(id);
+      if(!function)
+        return ParseError("Undeclared function", get_cur_tok_pos());
+      // The callee's declaration fixes how many arguments there are.
+      auto call = arena.make<ast::Call>(name, name_len,
+        arena.make_array<ast::Expr*>(function->param_count));
+      if(match(TokenType::rparen)){
+        if(function->param_count)
+          return ParseError("Wrong number of arguments", get_cur_tok_pos());
+        return call;
+      }
+      // The arguments are closed by parse_expr, like a parenthesis.
+      expr_frames.push_back({ExprFrame::Type::Call, ast::OpType{}, precedence, call, 0, 0});
+      precedence = 0;
+    }else break;
   }
 
   if(!match(TokenType::li_int))
     return ParseError("Expected expression", get_cur_tok_pos());
   
-  char const* val = tokens[tok_pos - 1].get_name();
-  unsigned val_len = tokens[tok_pos - 1].get_name_len();
+  std::int64_t val = lexer.last().get_int_value();
 
   return 
-    std::shared_ptr<ast::Expr>(std::make_shared<ast::Constant>(val, val_len));
-}
-
-// Unary -> - | ~ Factor
-Expected<Ptr<ast::Unary>, ParseError>
-Parser::parse_unary(){
-  auto op_type = convert_token_to_op(get_cur_tok_type());
-  ++tok_pos; //NOTE
-  auto expr = parse_factor();
-  if(expr.is_err()) return expr.unwrap_err();
-  return std::make_shared<ast::Unary>(op_type, expr.unwrap());
+    arena.make<ast::Constant>(val);
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include "cfg.h"
+#include "optimizer.h"
+#include <cstdint>
+
+namespace niubcc{
+namespace ir{
+
+namespace{
+bool
+is_jump(Kind kind){
+  return kind == Kind::Jmp || kind == Kind::Jz || kind == Kind::Jnz;
+}
+
+// The one instruction of a block after its labels, or null.
+Inst const*
+only_inst(BasicBlock const& block){
+  std::size_t start = 0;
+  while(start < block.insts.size() && block.insts[start].kind == Kind::Label) ++start;
+  return start + 1 == block.insts.size() ? &block.insts[start] : nullptr;
+}
+
+// Where a jump to each label ends up after passing through blocks that
+// only jump on, as the first label of that block. A cycle of such blocks
+// is entered at the label where the walk meets it.
+std::vector<std::uint32_t>
+thread_targets(FunctionDef const& fn, Cfg const& cfg){
+  enum : std::uint8_t{unseen, walking, done};
+  std::vector<std::uint32_t> dest(fn.label_count);
+  std::vector<std::uint8_t> state(fn.label_count, unseen);
+  std::vector<std::uint32_t> chain;
+  for(std::uint32_t label = 0; label < fn.label_count; ++label){
+    auto cur = label;
+    for(;;){
+      if(state[cur] == done){
+        cur = dest[cur];
+        break;
+      }
+      if(state[cur] == walking) break;
+      state[cur] = walking;
+      chain.push_back(cur);
+      auto block = cfg.label_blocks[cur];
+      auto inst = block == Cfg::none ? nullptr : only_inst(cfg.blocks[block]);
+      if(!inst || inst->kind != Kind::Jmp){
+        if(block != Cfg::none) cur = cfg.blocks[block].insts[0].target;
+        break;
+      }
+      cur = inst->target;
+    }
+    for(auto l: chain){
+      dest[l] = cur;
+      state[l] = done;
+    }
+    chain.clear();
+  }
+  return dest;
+}
+}
+
+// Each round first retargets jumps, then drops what that made redundant;
+// merging waits for a round in which the edges are exact. Every change
+// but threading removes an instruction or a Jmp, so this terminates.
+bool
+simplify_cfg(FunctionDef& fn){
+  bool changed = false;
+  for(bool again = true; again;){
+    again = false;
+    auto cfg = Cfg::build(fn);
+    auto& blocks = cfg.blocks;
+
+    // Thread jumps through blocks that only jump, and replace a Jmp to a
+    // block that only returns with the return.
+    auto dest = thread_targets(fn, cfg);
+    auto retarget = [&](std::uint32_t& label){
+      if(dest[label] == label) return;
+      label = dest[label];
+      again = true;
+    };
+    for(auto& block: blocks){
+      if(block.insts.empty()) continue;
+      auto& last = block.insts.back();
+      if(is_jump(last.kind)) retarget(last.target);
+      if(last.kind == Kind::Jmp){
+        auto target = cfg.label_blocks[last.target];
+        auto inst = target == Cfg::none ? nullptr : only_inst(blocks[target]);
+        if(inst && inst->kind == Kind::Ret){
+          last = *inst;
+          again = true;
+        }
+      }
+      if(last.kind == Kind::JumpTable){
+        auto& table = fn.tables[last.target];
+        for(std::uint32_t i = 0; i < table.target_count; ++i)
+          retarget(fn.targets[table.first_target + i]);
+      }
+    }
+    if(again) cfg.analyze(fn);
+
+    // Unreachable blocks go; a reachable block never falls through into
+    // one, so the rest keep their layout.
+    std::vector<std::uint32_t> order;
+    for(std::uint32_t b = 0; b < blocks.size(); ++b){
+      if(cfg.reachable(b)) order.push_back(b);
+      else if(!blocks[b].insts.empty()) again = true;
+    }
+    std::vector<std::uint32_t> uses(fn.label_count);
+    for(auto b: order){
+      auto& insts = blocks[b].insts;
+      if(insts.empty()) continue;
+      auto& last = insts.back();
+      if(is_jump(last.kind)) ++uses[last.target];
+      if(last.kind == Kind::JumpTable){
+        auto& table = fn.tables[last.target];
+        for(std::uint32_t i = 0; i < table.target_count; ++i)
+          ++uses[fn.targets[table.first_target + i]];
+      }
+    }
+
+    // Drop jumps to the next block, and turn `Jz L; Jmp M; L:` into
+    // `Jnz M; L:`.
+    auto starts = [&](std::uint32_t label, std::size_t pos){
+      return pos < order.size() && cfg.label_blocks[label] == order[pos];
+    };
+    for(std::size_t i = 0; i < order.size(); ++i){
+      auto& insts = blocks[order[i]].insts;
+      if(insts.empty() || !is_jump(insts.back().kind)) continue;
+      auto& last = insts.back();
+      if(starts(last.target, i + 1)){
+        --uses[last.target];
+        insts.pop_back();
+        again = true;
+        continue;
+      }
+      if(last.kind == Kind::Jmp || !starts(last.target, i + 2)) continue;
+      auto& next = blocks[order[i + 1]].insts;
+      if(next.size() != 1 || next[0].kind != Kind::Jmp) continue;
+      --uses[last.target];
+      last = last.kind == Kind::Jz ? Inst::jnz(next[0].target, last.src_1)
+        : Inst::jz(next[0].target, last.src_1);
+      next.clear();
+      again = true;
+    }
+
+    // Drop labels nothing jumps to.
+    for(auto b: order){
+      auto& insts = blocks[b].insts;
+      std::size_t kept = 0;
+      for(auto& inst: insts){
+        if(inst.kind == Kind::Label && !uses[inst.target]){
+          again = true;
+          continue;
+        }
+        insts[kept++] = inst;
+      }
+      insts.resize(kept);
+    }
+
+    if(!again){
+      // Move a block that only its Jmp reaches, and that does not fall
+      // through, in place of the Jmp. host follows blocks already moved.
+      std::vector<std::uint32_t> host(blocks.size());
+      for(std::uint32_t b = 0; b < blocks.size(); ++b) host[b] = b;
+      for(std::uint32_t b = 1; b < blocks.size(); ++b){
+        auto& block = blocks[b];
+        if(block.preds.size() != 1 || Cfg::falls_through(block)) continue;
+        auto h = block.preds[0];
+        while(host[h] != h) h = host[h];
+        auto& insts = blocks[h].insts;
+        if(h == b || insts.empty() || insts.back().kind != Kind::Jmp
+          || cfg.label_blocks[insts.back().target] != b)
+          continue;
+        insts.pop_back();
+        for(auto& inst: block.insts)
+          if(inst.kind != Kind::Label) insts.push_back(inst);
+        block.insts.clear();
+        host[b] = h;
+        again = true;
+      }
+    }
+
+    if(again){
+      std::vector<BasicBlock> kept;
+      for(auto b: order) kept.push_back(std::move(blocks[b]));
+      blocks = std::move(kept);
+      cfg.linearize(fn);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+}
+}
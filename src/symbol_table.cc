@@ -4,61 +4,51 @@
 
 namespace niubcc{
 
-std::string
-SymbolTable::make_label_name(char const* name, unsigned len){
-  return niubcc::utils::fmt(".userdefl%.*s.%u", len, name, label_num++);
+std::optional<std::uint32_t>
+SymbolTable::lookup_and_add(std::uint32_t id){
+  if(id >= innermost.size()) innermost.resize(id + 1, no_binding);
+  auto& head = innermost[id];
+  auto scope_start = scope_starts.empty() ? 0 : scope_starts.back();
+  if(head != no_binding && head >= scope_start) return std::nullopt;
+  bindings.push_back(Binding{id, head, var_count++});
+  head = bindings.size() - 1;
+  return bindings.back().slot;
 }
 
-std::string
-SymbolTable::make_tmp_name(char const* name, unsigned len){
-  return niubcc::utils::fmt("%.*s.%u", len, name, tmp_num++);
+std::optional<std::uint32_t>
+SymbolTable::lookup_and_get(std::uint32_t id){
+  if(id >= innermost.size() || innermost[id] == no_binding) return std::nullopt;
+  return bindings[innermost[id]].slot;
 }
 
-std::shared_ptr<std::string>
-SymbolTable::lookup_and_add(const char* name, unsigned len){
-  std::string_view look_name(name, len);
-  if(cur_scope->table.count(look_name)) return 0;
-  cur_scope->table[look_name] = std::make_shared<std::string>(make_tmp_name(name, len));
-  return cur_scope->table[look_name];
-}
-
-std::shared_ptr<std::string>
-SymbolTable::lookup_and_get(const char* name, unsigned len){
-  std::string_view look_name(name, len);
-  auto scope = cur_scope;
-  while(scope){
-    if(scope->table.count(look_name)) return scope->table[look_name];
-    scope = scope->outer;
-  }
-  return 0;
-}
-
-std::shared_ptr<std::string>
-SymbolTable::define_label(const char* name, unsigned len, utils::Pos pos){
-  std::string_view look_name(name, len);
-  if(labels.count(look_name)){
-    if(labels[look_name].is_defined) return 0;
-    labels[look_name].is_defined = true;
-  }else{
-    labels[look_name] = LabelEntry{
-      .pos = pos,
-      .name = std::make_shared<std::string>(make_label_name(name, len)),
-      .is_defined = true,
-    };
+std::optional<std::uint32_t>
+SymbolTable::define_label(std::uint32_t id, utils::Pos pos){
+  auto it = labels.find(id);
+  if(it != labels.end()){
+    if(it->second.is_defined) return std::nullopt;
+    it->second.is_defined = true;
+    return it->second.number;
   }
-  return labels[look_name].name;
+  std::uint32_t number = labels.size();
+  labels[id] = LabelEntry{
+    .pos = pos,
+    .number = number,
+    .is_defined = true,
+  };
+  return number;
 }
 
-std::shared_ptr<std::string>
-SymbolTable::add_label(char const* name, unsigned len, utils::Pos pos){
-  std::string_view look_name(name, len);
-  if(labels.count(look_name)) return labels[look_name].name;
-  labels[look_name] = LabelEntry{
+std::uint32_t
+SymbolTable::add_label(std::uint32_t id, utils::Pos pos){
+  auto it = labels.find(id);
+  if(it != labels.end()) return it->second.number;
+  std::uint32_t number = labels.size();
+  labels[id] = LabelEntry{
     .pos = pos,
-    .name = std::make_shared<std::string>(make_label_name(name, len)),
+    .number = number,
     .is_defined = false,
   };
-  return labels[look_name].name;
+  return number;
 }
 
 std::optional<utils::Pos>
@@ -70,13 +60,19 @@ SymbolTable::resolve_all_labels(){
 
 void
 SymbolTable::enter_scope(){
-  cur_scope = std::make_shared<Scope>(cur_scope);
+  scope_starts.push_back(bindings.size());
 }
 
 void
 SymbolTable::leave_scope(){
-  if(!cur_scope->outer) return;
-  cur_scope = cur_scope->outer;
+  if(scope_starts.empty()) return;
+  auto scope_start = scope_starts.back();
+  scope_starts.pop_back();
+  while(bindings.size() > scope_start){
+    auto& binding = bindings.back();
+    innermost[binding.id] = binding.shadowed;
+    bindings.pop_back();
+  }
 }
 
 }
\ No newline at end of file
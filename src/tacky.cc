@@ -1,40 +1,100 @@
 #include "tacky.h"
 #include "utils.h"
-#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <vector>
 
 namespace niubcc{
 namespace ir{
 
-void
-AstBuilder::append_cur_insts(Ptr<Inst> inst){
-  if(!cur_insts){
-    cur_insts_tail = cur_insts = inst;
-    return;
+namespace{
+// Switches with up to this many cases compare against each in turn.
+constexpr std::size_t linear_switch_cases = 3;
+// A jump table needs a few cases filling at least a third of a range
+// of bounded size.
+constexpr std::size_t min_jump_table_cases = 4;
+constexpr std::int64_t max_jump_table_range = 4096;
+// Bit tests replace a jump table when the range fits in a 32-bit mask
+// and only a few distinct labels are reached.
+constexpr std::int64_t bit_test_range = 32;
+constexpr std::size_t max_bit_test_targets = 3;
+// Else-if chains shorter than this are compared in order anyway.
+constexpr std::size_t min_if_chain = linear_switch_cases + 1;
+
+// Value of a literal, possibly negated or complemented.
+bool
+constant_of(ast::Expr* expr, std::int64_t& value){
+  if(expr->kind == ast::Kind::Constant){
+    value = static_cast<ast::Constant*>(expr)->value;
+    return true;
   }
-  cur_insts_tail->next = inst;
-  cur_insts_tail = inst;
+  if(expr->kind != ast::Kind::Unary) return false;
+  auto p = static_cast<ast::Unary*>(expr);
+  if(p->op_type != ast::OpType::op_minus && p->op_type != ast::OpType::op_bitnot) return false;
+  if(!constant_of(p->expr, value)) return false;
+  auto v = static_cast<std::uint32_t>(value);
+  value = static_cast<std::int32_t>(p->op_type == ast::OpType::op_minus ? 0u - v : ~v);
+  return true;
 }
 
-Ptr<Program>
-AstBuilder::build(Ptr<ast::BaseNode> node){
-  if(auto p = std::dynamic_pointer_cast<ast::Program>(node))
-    return build(p);
-  return 0;
+// Match `var == constant` or `constant == var`.
+bool
+match_eq(ast::Expr* cond, std::uint32_t& slot, std::int64_t& value){
+  if(cond->kind != ast::Kind::Binary) return false;
+  auto p = static_cast<ast::Binary*>(cond);
+  if(p->op_type != ast::OpType::op_eq) return false;
+  auto var = p->lhs, other = p->rhs;
+  if(var->kind != ast::Kind::Var) std::swap(var, other);
+  if(var->kind != ast::Kind::Var || !constant_of(other, value)) return false;
+  slot = static_cast<ast::Var*>(var)->slot;
+  return true;
+}
+}
+
+Val
+AstBuilder::get_constant(std::int64_t value){
+  auto [it, inserted] = constant_index.try_emplace(value);
+  if(inserted) it->second = fn.add_constant(value).index();
+  return Val::constant(it->second);
 }
 
 Ptr<Program>
-AstBuilder::build(Ptr<ast::Program> node){
-  return std::make_shared<Program>(build(node->funcdef));
+AstBuilder::build(ast::BaseNode* node){
+  if(node->kind == ast::Kind::Program)
+    return build(static_cast<ast::Program*>(node));
+  return 0;
 }
 
-Ptr<FunctionDef>
-AstBuilder::build(Ptr<ast::FunctionDef> node){
+Ptr<Program>
+AstBuilder::build(ast::Program* node){
+  auto program = std::make_shared<Program>();
+  program->funcdefs.reserve(node->funcdefs.size());
+  for(auto funcdef: node->funcdefs)
+    program->funcdefs.push_back(build(funcdef));
+  return program;
+}
+
+FunctionDef
+AstBuilder::build(ast::FunctionDef* node){
+  fn = FunctionDef{};
+  fn.name = node->name;
+  fn.name_len = node->name_len;
+  fn.param_count = node->params.size();
+  fn.tmp_count = node->var_count;
+  label_number = 0;
+  label_map.clear();
+  case_labels.clear();
+  constant_index.clear();
   build(node->blocks);
-  return std::make_shared<FunctionDef>(node->name, node->name_len, cur_insts);
+  // Falling off the end returns 0, as in the baseline tier.
+  if(fn.insts.empty() || fn.insts.back().kind != Kind::Ret)
+    append_cur_insts(Inst::ret(get_constant(0)));
+  fn.label_count = label_number;
+  return std::move(fn);
 }
 
 void
-AstBuilder::build(Ptr<ast::CompoundStmt> node){
+AstBuilder::build(ast::CompoundStmt* node){
   auto cur = node->blocks;
   while(cur){
     build(cur);
@@ -43,281 +103,533 @@ AstBuilder::build(Ptr<ast::CompoundStmt> node){
 }
 
 void
-AstBuilder::build(Ptr<ast::Block> node){
-  if(auto p = std::dynamic_pointer_cast<ast::Stmt>(node))
-    build(p);
-  if(auto p = std::dynamic_pointer_cast<ast::Decl>(node))
-    build(p);
-  return;
+AstBuilder::build(ast::Block* node){
+  if(node->kind == ast::Kind::Decl)
+    build(static_cast<ast::Decl*>(node));
+  else
+    build(static_cast<ast::Stmt*>(node));
 }
 
 void
-AstBuilder::build(Ptr<ast::Decl> node){
+AstBuilder::build(ast::Decl* node){
   if(!node->init) return;
-  auto decled = std::make_shared<Var>(get_tmp_val(node->name));
   auto init = build(node->init);
-  auto copy = std::make_shared<Copy>(init, decled);
-  append_cur_insts(copy);
+  append_cur_insts(Inst::copy(init, Val::var(node->slot)));
 }
 
 void
-AstBuilder::build(Ptr<ast::Stmt> node){
-  if(node->label)
-    append_cur_insts(std::make_shared<Label>(get_label(node->label)));
-
-  if(auto p = std::dynamic_pointer_cast<ast::RetStmt>(node))
-    build(p);
-  if(auto p = std::dynamic_pointer_cast<ast::ExprStmt>(node))
-    build(p);
-  if(auto p = std::dynamic_pointer_cast<ast::IfStmt>(node))
-    build(p);
-  if(auto p = std::dynamic_pointer_cast<ast::CompoundStmt>(node))
-    build(p);
-  if(auto p = std::dynamic_pointer_cast<ast::GotoStmt>(node))
-    build(p);
-  return; 
+AstBuilder::build(ast::Stmt* node){
+  if(node->label.name)
+    append_cur_insts(Inst::label(get_label(node->label)));
+
+  switch(node->kind){
+    case ast::Kind::RetStmt: build(static_cast<ast::RetStmt*>(node)); break;
+    case ast::Kind::ExprStmt: build(static_cast<ast::ExprStmt*>(node)); break;
+    case ast::Kind::IfStmt: build(static_cast<ast::IfStmt*>(node)); break;
+    case ast::Kind::CompoundStmt: build(static_cast<ast::CompoundStmt*>(node)); break;
+    case ast::Kind::GotoStmt: build(static_cast<ast::GotoStmt*>(node)); break;
+    case ast::Kind::WhileStmt: build(static_cast<ast::WhileStmt*>(node)); break;
+    case ast::Kind::DoStmt: build(static_cast<ast::DoStmt*>(node)); break;
+    case ast::Kind::ForStmt: build(static_cast<ast::ForStmt*>(node)); break;
+    case ast::Kind::SwitchStmt: build(static_cast<ast::SwitchStmt*>(node)); break;
+    case ast::Kind::CaseStmt: build(static_cast<ast::CaseStmt*>(node)); break;
+    case ast::Kind::Break:
+      append_cur_insts(Inst::jmp(jumps.back().break_label));
+      break;
+    case ast::Kind::Continue:
+      append_cur_insts(Inst::jmp(jumps.back().continue_label));
+      break;
+    default: break;
+  }
 }
 
 void
-AstBuilder::build(Ptr<ast::RetStmt> node){
-  auto val = build(node->ret_val);
-  auto ret = std::make_shared<Ret>(val);
-  append_cur_insts(ret);
+AstBuilder::build(ast::RetStmt* node){
+  append_cur_insts(Inst::ret(build(node->ret_val)));
 }
 
 void
-AstBuilder::build(Ptr<ast::IfStmt> node){
+AstBuilder::build(ast::IfStmt* node){
+  if(build_if_chain(node)) return;
   auto cond_res = build(node->condition);
-  auto end_l = std::make_shared<Label>(get_label());
-  auto else_l = node->else_stmt ? std::make_shared<Label>(get_label()) : 0;
+  auto end_l = get_label();
+  auto else_l = node->else_stmt ? get_label() : end_l;
 
-  if(else_l)
-    append_cur_insts(std::make_shared<Jz>(else_l->number, cond_res));
-  else
-    append_cur_insts(std::make_shared<Jz>(end_l->number, cond_res));
+  append_cur_insts(Inst::jz(else_l, cond_res));
 
   build(node->then_stmt);
-  append_cur_insts(std::make_shared<Jmp>(end_l->number));
+  append_cur_insts(Inst::jmp(end_l));
 
-  if(else_l){
-    append_cur_insts(else_l);
+  if(node->else_stmt){
+    append_cur_insts(Inst::label(else_l));
     build(node->else_stmt);
   }
 
-  append_cur_insts(end_l);
+  append_cur_insts(Inst::label(end_l));
 }
 
 void
-AstBuilder::build(Ptr<ast::GotoStmt> node){
-  append_cur_insts(std::make_shared<Jmp>(get_label(node->label)));
+AstBuilder::build(ast::WhileStmt* node){
+  auto continue_l = get_label();
+  auto break_l = get_label();
+  append_cur_insts(Inst::label(continue_l));
+  append_cur_insts(Inst::jz(break_l, build(node->condition)));
+  jumps.push_back({break_l, continue_l});
+  build(node->stmt);
+  jumps.pop_back();
+  append_cur_insts(Inst::jmp(continue_l));
+  append_cur_insts(Inst::label(break_l));
 }
 
 void
-AstBuilder::build(Ptr<ast::ExprStmt> node){
-  build(node->expr);
-}
-
-Ptr<Val>
-AstBuilder::build(Ptr<ast::Expr> node){
-  if(auto p = std::dynamic_pointer_cast<ast::Constant>(node))
-    return build(p);
-  if(auto p = std::dynamic_pointer_cast<ast::Var>(node))
-    return build(p);
-  if(auto p = std::dynamic_pointer_cast<ast::Unary>(node))
-    return build(p);
-  if(auto p = std::dynamic_pointer_cast<ast::Binary>(node))
-    return build(p);
-  if(auto p = std::dynamic_pointer_cast<ast::Assign>(node))
-    return build(p);
-  if(auto p = std::dynamic_pointer_cast<ast::Condition>(node))
-    return build(p);
-  return 0;
-}
-
-Ptr<Val>
-AstBuilder::build(Ptr<ast::Assign> node){
-  auto dst = build(node->dst);
-  auto src = build(node->src);
-  append_cur_insts(std::make_shared<Copy>(src, dst));
-  return dst;
-}
-
-Ptr<Var>
-AstBuilder::build(Ptr<ast::Condition> node){
-  auto res = std::make_shared<Var>(get_tmp_val());
-  auto cond_res = build(node->condition);
-  auto false_l = std::make_shared<Label>(get_label());
-  auto end_l = std::make_shared<Label>(get_label());
-
-  append_cur_insts(std::make_shared<Jz>(false_l->number, cond_res));
-
-  auto true_val = build(node->true_val);
-  append_cur_insts(std::make_shared<Copy>(true_val, res));
-  append_cur_insts(std::make_shared<Jmp>(end_l->number));
-
-  append_cur_insts(false_l);
-
-  auto false_val = build(node->false_val);
-  append_cur_insts(std::make_shared<Copy>(false_val, res));
-
-  append_cur_insts(end_l);
-
-  return res;
-}
-
-Ptr<Constant>
-AstBuilder::build(Ptr<ast::Constant> node){
-  return std::make_shared<Constant>(node->value, node->value_len);
-}
-
-Ptr<Var>
-AstBuilder::build(Ptr<ast::Var> node){
-  return std::make_shared<Var>(get_tmp_val(node->name));
-}
-
-Ptr<Var>
-AstBuilder::build(Ptr<ast::Unary> node){
-  auto src = build(node->expr);
-  auto dest = std::make_shared<Var>(get_tmp_val());
-  auto inst = std::make_shared<Unary>(node->op_type, src, dest);
-  append_cur_insts(inst);
-  return dest;
-}
-
-Ptr<Var>
-AstBuilder::build_logic_and(Ptr<ast::Binary> node){
-  auto dest = std::make_shared<Var>(get_tmp_val());
-   
-  auto false_val = std::make_shared<Constant>("0", 1);
-  auto true_val = std::make_shared<Constant>("1", 1);
-   
-  auto false_l = std::make_shared<Label>(get_label());
-  auto end_l = std::make_shared<Label>(get_label());
-
-  auto src_1 = build(node->lhs);                                      // ins of e1
-  append_cur_insts(std::make_shared<Jz>(false_l->number, src_1));     // jz (e1) false_l
-
-  auto src_2 = build(node->rhs);                                      // ins of e2
-  append_cur_insts(std::make_shared<Jz>(false_l->number, src_2));     // jz (e2) false_l
-
-  append_cur_insts(std::make_shared<Copy>(true_val, dest));           // mov $1, dst
-  append_cur_insts(std::make_shared<Jmp>(end_l->number));             // jmp end
-  append_cur_insts(false_l);                                          // false_l:
-  append_cur_insts(std::make_shared<Copy>(false_val, dest));          // mov $0, dst
-  append_cur_insts(end_l);                                            // end:
-  return dest;
-}
-
-Ptr<Var>
-AstBuilder::build_logic_or(Ptr<ast::Binary> node){
-  auto dest = std::make_shared<Var>(get_tmp_val());
-   
-  auto false_val = std::make_shared<Constant>("0", 1);
-  auto true_val = std::make_shared<Constant>("1", 1);
-   
-  auto true_l = std::make_shared<Label>(get_label());
-  auto end_l = std::make_shared<Label>(get_label());
-
-  auto src_1 = build(node->lhs);                                      // ins of e1
-  append_cur_insts(std::make_shared<Jnz>(true_l->number, src_1));     // jnz (e1) true_l
-
-  auto src_2 = build(node->rhs);                                      // ins of e2
-  append_cur_insts(std::make_shared<Jnz>(true_l->number, src_2));     // jz (e2) false_l
-
-  append_cur_insts(std::make_shared<Copy>(false_val, dest));          // mov $0, dst
-  append_cur_insts(std::make_shared<Jmp>(end_l->number));             // jmp end
-  append_cur_insts(true_l);                                           // true_l:
-  append_cur_insts(std::make_shared<Copy>(true_val, dest));           // mov $1, dst
-  append_cur_insts(end_l);                                            // end:
-  return dest;
-}
-
-Ptr<Var>
-AstBuilder::build(Ptr<ast::Binary> node){
-  if(node->op_type == ast::OpType::op_or)
-    return build_logic_or(node);
-  if(node->op_type == ast::OpType::op_and)
-    return build_logic_and(node);
-  // Note that we evaluate expr form right hand
-  // but for some operations (such as sub and div), the lhs should come first.
-  auto src_2 = build(node->rhs);
-  auto src_1 = build(node->lhs);
-  auto dest = std::make_shared<Var>(get_tmp_val());
-  auto inst = std::make_shared<Binary>(node->op_type, src_1, src_2, dest);
-  append_cur_insts(inst);
-  return dest;
+AstBuilder::build(ast::DoStmt* node){
+  auto start_l = get_label();
+  auto continue_l = get_label();
+  auto break_l = get_label();
+  append_cur_insts(Inst::label(start_l));
+  jumps.push_back({break_l, continue_l});
+  build(node->stmt);
+  jumps.pop_back();
+  append_cur_insts(Inst::label(continue_l));
+  append_cur_insts(Inst::jnz(start_l, build(node->condition)));
+  append_cur_insts(Inst::label(break_l));
 }
 
 void
-Program::print(){
-  std::cout << utils::fmt("Program:\n");
-  funcdef->print();
-}
-
+AstBuilder::build(ast::ForStmt* node){
+  if(auto init = node->init){
+    for(ast::Block* decl = init->decls; decl; decl = decl->next)
+      build(decl);
+    if(init->expr) build(init->expr);
+  }
+  auto start_l = get_label();
+  auto continue_l = get_label();
+  auto break_l = get_label();
+  append_cur_insts(Inst::label(start_l));
+  if(node->condition)
+    append_cur_insts(Inst::jz(break_l, build(node->condition)));
+  jumps.push_back({break_l, continue_l});
+  build(node->stmt);
+  jumps.pop_back();
+  append_cur_insts(Inst::label(continue_l));
+  if(node->post) build(node->post);
+  append_cur_insts(Inst::jmp(start_l));
+  append_cur_insts(Inst::label(break_l));
+}
+
+// Cases are reached through a dispatch on the sorted case values: a few
+// cases compare one by one, dense ones index a jump table, small ranges
+// with few targets test a bit mask, and the rest split in half around
+// the median and recurse.
 void
-FunctionDef::print(){
-  std::cout << utils::fmt("Function %.*s:\n", name_len, name);
-  auto p = instructions;
-  while(p){
-    p->print();
-    p = p->next;
+AstBuilder::build(ast::SwitchStmt* node){
+  auto cond = build(node->condition);
+  auto break_l = get_label();
+  auto default_l = break_l;
+
+  // A case labelling another case shares its label, so that runs of
+  // case labels on one statement count as one target.
+  std::vector<SwitchCase> cases;
+  cases.reserve(node->cases.size());
+  for(auto it = node->cases.rbegin(); it != node->cases.rend(); ++it){
+    auto c = *it;
+    auto label = c->stmt->kind == ast::Kind::CaseStmt
+      ? case_labels[static_cast<ast::CaseStmt*>(c->stmt)] : get_label();
+    case_labels[c] = label;
+    if(c->is_default) default_l = label;
+    else cases.push_back({c->value, label});
   }
+  std::sort(cases.begin(), cases.end(),
+    [](SwitchCase const& a, SwitchCase const& b){return a.value < b.value;});
+  // Without case values, e.g. switch(x){}, control goes straight to the
+  // default or past the body.
+  if(cases.empty()) append_cur_insts(Inst::jmp(default_l));
+  else build_dispatch(cond, cases.data(), cases.data() + cases.size(), default_l);
+
+  jumps.push_back({break_l, jumps.empty() ? 0 : jumps.back().continue_label});
+  build(node->body);
+  jumps.pop_back();
+  append_cur_insts(Inst::label(break_l));
 }
 
 void
-Ret::print(){
-  std::cout << utils::fmt("Ret(%s)\n", val->print().c_str());
-}
+AstBuilder::build_dispatch(Val cond, SwitchCase const* first, SwitchCase const* last,
+  unsigned default_label){
+  auto apply = [this](ast::OpType op, Val lhs, Val rhs){
+    auto dest = get_tmp_val();
+    append_cur_insts(Inst::binary(op, lhs, rhs, dest));
+    return dest;
+  };
+  auto compare = [&](ast::OpType op, std::int64_t value){
+    return apply(op, cond, get_constant(value));
+  };
+
+  std::size_t count = last - first;
+  if(count <= linear_switch_cases){
+    for(auto it = first; it != last; ++it)
+      append_cur_insts(Inst::jnz(it->label, compare(ast::OpType::op_eq, it->value)));
+    append_cur_insts(Inst::jmp(default_label));
+    return;
+  }
 
-std::string
-Var::print(){
-  return utils::fmt("Var(tmp.%u)", number);
-}
+  auto low = first->value;
+  auto high = last[-1].value;
+  auto range = high - low + 1;
+  // Distinct targets with the mask of the values reaching each.
+  std::vector<std::pair<unsigned, std::uint32_t> > targets;
+  if(range <= bit_test_range){
+    for(auto it = first; it != last && targets.size() <= max_bit_test_targets; ++it){
+      auto target = std::find_if(targets.begin(), targets.end(),
+        [it](auto const& t){return t.first == it->label;});
+      if(target == targets.end()) target = targets.insert(targets.end(), {it->label, 0});
+      target->second |= 1u << (it->value - low);
+    }
+  }
+  bool bit_test = range <= bit_test_range && targets.size() <= max_bit_test_targets;
+  bool jump_table = count >= min_jump_table_cases && range <= max_jump_table_range
+    && range <= 3 * static_cast<std::int64_t>(count);
+
+  if(!bit_test && !jump_table){
+    auto mid = first + count / 2;
+    auto upper_l = get_label();
+    append_cur_insts(Inst::jnz(upper_l, compare(ast::OpType::op_ge, mid->value)));
+    build_dispatch(cond, first, mid, default_label);
+    append_cur_insts(Inst::label(upper_l));
+    build_dispatch(cond, mid, last, default_label);
+    return;
+  }
 
-std::string
-Constant::print(){
-  return utils::fmt("Constant(%.*s)", val_len, val);
+  append_cur_insts(Inst::jnz(default_label, compare(ast::OpType::op_lt, low)));
+  append_cur_insts(Inst::jnz(default_label, compare(ast::OpType::op_gt, high)));
+  auto index = compare(ast::OpType::op_minus, low);
+  if(bit_test){
+    auto bit = apply(ast::OpType::op_lshift, get_constant(1), index);
+    for(auto [label, mask]: targets){
+      auto hit = apply(ast::OpType::op_bitand, bit,
+        get_constant(static_cast<std::int32_t>(mask)));
+      append_cur_insts(Inst::jnz(label, hit));
+    }
+    append_cur_insts(Inst::jmp(default_label));
+    return;
+  }
+  auto first_target = fn.targets.size();
+  fn.targets.resize(first_target + range, default_label);
+  for(auto it = first; it != last; ++it)
+    fn.targets[first_target + (it->value - low)] = it->label;
+  fn.tables.push_back({get_label(), static_cast<std::uint32_t>(first_target),
+    static_cast<std::uint32_t>(range)});
+  append_cur_insts(Inst::jump_table(fn.tables.size() - 1, index));
+}
+
+// The tests have no side effects and none of the branches runs before
+// the last test that precedes it, so all of them can be done up front.
+// A labelled if in the chain can be entered by goto and ends the chain.
+bool
+AstBuilder::build_if_chain(ast::IfStmt* node){
+  std::uint32_t slot, link_slot;
+  std::int64_t value;
+  if(!match_eq(node->condition, slot, value)) return false;
+  std::vector<ast::IfStmt*> links{node};
+  std::vector<SwitchCase> cases{{value, 0}};
+  for(auto cur = node->else_stmt; cur && cur->kind == ast::Kind::IfStmt && !cur->label.name;){
+    auto link = static_cast<ast::IfStmt*>(cur);
+    if(!match_eq(link->condition, link_slot, value) || link_slot != slot) break;
+    cases.push_back({value, static_cast<unsigned>(links.size())});
+    links.push_back(link);
+    cur = link->else_stmt;
+  }
+  if(links.size() < min_if_chain) return false;
+
+  std::vector<unsigned> labels(links.size());
+  for(auto& label: labels) label = get_label();
+  auto end_l = get_label();
+  auto else_stmt = links.back()->else_stmt;
+  auto else_l = else_stmt ? get_label() : end_l;
+  // Only the first test of a repeated value can succeed.
+  std::stable_sort(cases.begin(), cases.end(),
+    [](SwitchCase const& a, SwitchCase const& b){return a.value < b.value;});
+  cases.erase(std::unique(cases.begin(), cases.end(),
+    [](SwitchCase const& a, SwitchCase const& b){return a.value == b.value;}), cases.end());
+  for(auto& c: cases) c.label = labels[c.label];
+  build_dispatch(Val::var(slot), cases.data(), cases.data() + cases.size(), else_l);
+
+  for(std::size_t i = 0; i < links.size(); ++i){
+    append_cur_insts(Inst::label(labels[i]));
+    build(links[i]->then_stmt);
+    append_cur_insts(Inst::jmp(end_l));
+  }
+  if(else_stmt){
+    append_cur_insts(Inst::label(else_l));
+    build(else_stmt);
+  }
+  append_cur_insts(Inst::label(end_l));
+  return true;
 }
 
 void
-Unary::print(){
-  std::cout << utils::fmt("Unary(%s, %s, %s)\n",
-    ast::map_op_name[static_cast<unsigned>(op)],
-    src->print().c_str(), dst->print().c_str());
+AstBuilder::build(ast::CaseStmt* node){
+  // The outer ones of stacked case labels are placed by the innermost.
+  if(node->stmt->kind != ast::Kind::CaseStmt)
+    append_cur_insts(Inst::label(case_labels[node]));
+  build(node->stmt);
 }
 
 void
-Binary::print(){
-  std::cout << utils::fmt("Binary(%s, %s, %s, %s)\n",
-    ast::map_op_name[static_cast<unsigned>(op)],
-    src_1->print().c_str(),
-    src_2->print().c_str(),
-    dst->print().c_str());
+AstBuilder::build(ast::GotoStmt* node){
+  append_cur_insts(Inst::jmp(get_label(node->target)));
 }
 
 void
-Label::print(){
-  std::cout << utils::fmt("Lable(.L%u)\n", number);
+AstBuilder::build(ast::ExprStmt* node){
+  build(node->expr);
 }
 
-void
-Jmp::print(){
-  std::cout << utils::fmt("Jmp(.L%u)\n", label);
+// Expressions are lowered in post order with an explicit stack, so the
+// nesting depth of the source does not bound the call stack. A frame is
+// revisited after each of its operands; finished operands are on vals.
+Val
+AstBuilder::build(ast::Expr* root){
+  struct Frame{
+    ast::Expr* node{0};
+    unsigned stage{0};
+    unsigned label_1{0};
+    unsigned label_2{0};
+    Val dest{};
+  };
+  std::vector<Frame> frames{{root}};
+  std::vector<Val> vals;
+
+  auto pop_val = [&vals](){
+    auto val = vals.back();
+    vals.pop_back();
+    return val;
+  };
+  // Finish the top frame with its result.
+  auto done = [&frames, &vals](Val res){
+    frames.pop_back();
+    vals.push_back(res);
+  };
+  auto visit = [&frames](ast::Expr* node){
+    frames.push_back({node});
+  };
+
+  while(!frames.empty()){
+    auto& frame = frames.back();
+    switch(auto node = frame.node; node->kind){
+      case ast::Kind::Constant:
+        done(get_constant(static_cast<ast::Constant*>(node)->value));
+        break;
+
+      case ast::Kind::Var:
+        done(Val::var(static_cast<ast::Var*>(node)->slot));
+        break;
+
+      case ast::Kind::Unary:{
+        auto p = static_cast<ast::Unary*>(node);
+        if(frame.stage++ == 0){
+          visit(p->expr);
+          break;
+        }
+        auto src = pop_val();
+        auto dest = get_tmp_val();
+        append_cur_insts(Inst::unary(p->op_type, src, dest));
+        done(dest);
+        break;
+      }
+
+      case ast::Kind::Assign:{
+        auto p = static_cast<ast::Assign*>(node);
+        switch(frame.stage++){
+          case 0: visit(p->dst); break;
+          case 1: visit(p->src); break;
+          default:{
+            auto src = pop_val();
+            auto dst = pop_val();
+            append_cur_insts(Inst::copy(src, dst));
+            done(dst);
+          }
+        }
+        break;
+      }
+
+      case ast::Kind::Condition:{
+        auto p = static_cast<ast::Condition*>(node);
+        switch(frame.stage++){
+          case 0:
+            frame.dest = get_tmp_val();
+            visit(p->condition);
+            break;
+          case 1:                                                     // label_1: false, label_2: end
+            frame.label_1 = get_label();
+            frame.label_2 = get_label();
+            append_cur_insts(Inst::jz(frame.label_1, pop_val()));
+            visit(p->true_val);
+            break;
+          case 2:
+            append_cur_insts(Inst::copy(pop_val(), frame.dest));
+            append_cur_insts(Inst::jmp(frame.label_2));
+            append_cur_insts(Inst::label(frame.label_1));
+            visit(p->false_val);
+            break;
+          default:
+            append_cur_insts(Inst::copy(pop_val(), frame.dest));
+            append_cur_insts(Inst::label(frame.label_2));
+            done(frame.dest);
+        }
+        break;
+      }
+
+      case ast::Kind::Call:{
+        // Arguments are evaluated left to right.
+        auto p = static_cast<ast::Call*>(node);
+        if(frame.stage < p->args.size()){
+          visit(p->args[frame.stage++]);
+          break;
+        }
+        std::uint32_t arg_count = p->args.size();
+        fn.calls.push_back({p->name, p->name_len, static_cast<std::uint32_t>(fn.args.size()), arg_count});
+        fn.args.insert(fn.args.end(), vals.end() - arg_count, vals.end());
+        vals.resize(vals.size() - arg_count);
+        auto dest = get_tmp_val();
+        append_cur_insts(Inst::call(fn.calls.size() - 1, dest));
+        done(dest);
+        break;
+      }
+
+      case ast::Kind::Binary:{
+        auto p = static_cast<ast::Binary*>(node);
+        if(p->op_type == ast::OpType::op_and || p->op_type == ast::OpType::op_or){
+          // and: jz (e1) false_l; jz (e2) false_l; dst = 1; jmp end; false_l: dst = 0; end:
+          // or:  jnz (e1) true_l; jnz (e2) true_l; dst = 0; jmp end; true_l: dst = 1; end:
+          bool is_and = p->op_type == ast::OpType::op_and;
+          auto branch = [&](unsigned label, Val cond){
+            return is_and ? Inst::jz(label, cond) : Inst::jnz(label, cond);
+          };
+          switch(frame.stage++){
+            case 0:
+              frame.dest = get_tmp_val();
+              frame.label_1 = get_label();
+              frame.label_2 = get_label();
+              visit(p->lhs);
+              break;
+            case 1:
+              append_cur_insts(branch(frame.label_1, pop_val()));
+              visit(p->rhs);
+              break;
+            default:{
+              append_cur_insts(branch(frame.label_1, pop_val()));
+              append_cur_insts(Inst::copy(get_constant(is_and), frame.dest));
+              append_cur_insts(Inst::jmp(frame.label_2));
+              append_cur_insts(Inst::label(frame.label_1));
+              append_cur_insts(Inst::copy(get_constant(!is_and), frame.dest));
+              append_cur_insts(Inst::label(frame.label_2));
+              done(frame.dest);
+            }
+          }
+          break;
+        }
+        // Note that we evaluate expr form right hand
+        // but for some operations (such as sub and div), the lhs should come first.
+        switch(frame.stage++){
+          case 0: visit(p->rhs); break;
+          case 1: visit(p->lhs); break;
+          default:{
+            auto src_1 = pop_val();
+            auto src_2 = pop_val();
+            auto dest = get_tmp_val();
+            append_cur_insts(Inst::binary(p->op_type, src_1, src_2, dest));
+            done(dest);
+          }
+        }
+        break;
+      }
+
+      default:
+        assert(0 && "unreachable");
+    }
+  }
+  return vals.back();
 }
 
 void
-Jnz::print(){
-  std::cout << utils::fmt("Jnz(.L%u, %s)\n", label, cond->print().c_str());
+Program::dump(utils::Sink& out)const{
+  out << "Program:\n";
+  for(auto& funcdef: funcdefs)
+    funcdef.dump(out);
 }
 
 void
-Jz::print(){
-  std::cout << utils::fmt("Jz(.L%u, %s)\n", label, cond->print().c_str());
+FunctionDef::dump(utils::Sink& out)const{
+  out << "Function " << std::string_view(name, name_len) << ":\n";
+  for(auto& inst: insts)
+    dump(out, inst);
 }
 
 void
-Copy::print(){
-  std::cout << utils::fmt("Copy(%s, %s)\n", src->print().c_str(), dst->print().c_str());
+FunctionDef::dump(utils::Sink& out, Inst const& inst)const{
+  auto val = [&](Val val)->utils::Sink&{
+    if(val.is_var()) return out << "Var(tmp." << val.index() << ')';
+    return out << "Constant(" << static_cast<long long>(value(val)) << ')';
+  };
+  auto op_name = [](ast::OpType op){return ast::map_op_name[static_cast<unsigned>(op)];};
+
+  switch(inst.kind){
+    case Kind::Ret:
+      out << "Ret(";
+      val(inst.src_1);
+      break;
+    case Kind::Unary:
+      out << "Unary(" << op_name(inst.op) << ", ";
+      val(inst.src_1) << ", ";
+      val(inst.dst);
+      break;
+    case Kind::Binary:
+      out << "Binary(" << op_name(inst.op) << ", ";
+      val(inst.src_1) << ", ";
+      val(inst.src_2) << ", ";
+      val(inst.dst);
+      break;
+    case Kind::Label:
+      out << "Lable(.L" << inst.target;
+      break;
+    case Kind::Jmp:
+      out << "Jmp(.L" << inst.target;
+      break;
+    case Kind::Jnz:
+      out << "Jnz(.L" << inst.target << ", ";
+      val(inst.src_1);
+      break;
+    case Kind::Jz:
+      out << "Jz(.L" << inst.target << ", ";
+      val(inst.src_1);
+      break;
+    case Kind::Copy:
+      out << "Copy(";
+      val(inst.src_1) << ", ";
+      val(inst.dst);
+      break;
+    case Kind::Call:{
+      auto& call = calls[inst.target];
+      out << "Call(" << std::string_view(call.name, call.name_len) << ", [";
+      for(std::uint32_t i = 0; i < call.arg_count; ++i){
+        if(i) out << ", ";
+        val(args[call.first_arg + i]);
+      }
+      out << "], ";
+      val(inst.dst);
+      break;
+    }
+    case Kind::JumpTable:{
+      auto& table = tables[inst.target];
+      out << "JumpTable(";
+      val(inst.src_1) << ", [";
+      for(std::uint32_t i = 0; i < table.target_count; ++i)
+        out << (i ? ", .L" : ".L") << targets[table.first_target + i];
+      out << ']';
+      break;
+    }
+  }
+  out << ")\n";
 }
 
 }
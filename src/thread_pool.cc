@@ -0,0 +1,37 @@
+#include "thread_pool.h"
+
+namespace niubcc{
+
+ThreadPool::ThreadPool(unsigned size){
+  if(!size) size = std::thread::hardware_concurrency();
+  if(!size) size = 1;
+  workers.reserve(size);
+  for(unsigned i = 0; i < size; ++i)
+    workers.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool(){
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  cond.notify_all();
+  for(auto& worker: workers) worker.join();
+}
+
+void
+ThreadPool::work(){
+  while(1){
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cond.wait(lock, [this]{return stopping || !tasks.empty();});
+      if(tasks.empty()) return;
+      task = std::move(tasks.front());
+      tasks.pop();
+    }
+    task();
+  }
+}
+
+}
@@ -25,30 +25,16 @@ Token::is_literal()const{
   );
 }
 
-std::optional<std::string>
-Token::fmt()const{
-  if(type == TokenType::unknown){
-    return std::nullopt;
-  }
-  if(is_keyword()) return utils::fmt(
-    "Keyword@%s (%u, %u)",
-    token_name_map[static_cast<unsigned short>(type)],
-    pos.line, pos.col
-  );
-  else if(is_literal()) return utils::fmt(
-    "Literal@%s@%.*s (%u, %u)",
-    token_name_map[static_cast<unsigned short>(type)],
-    addtional_len, raw_literal, pos.line, pos.col);
-  else if(is_ident()) return utils::fmt(
-    "Identifier@%s@%.*s (%u, %u)",
-    token_name_map[static_cast<unsigned short>(type)],
-    addtional_len, raw_indent, pos.line, pos.col);
-  else return utils::fmt(
-    "Token@%s (%u, %u)",
-    token_name_map[static_cast<unsigned short>(type)],
-    pos.line, pos.col
-  );
-
+void
+Token::dump(utils::Sink& out)const{
+  auto name = token_name_map[static_cast<unsigned short>(type)];
+  if(is_keyword()) out << "Keyword@" << name;
+  else if(is_literal())
+    out << "Literal@" << name << '@' << std::string_view(raw_literal, addtional_len);
+  else if(is_ident())
+    out << "Identifier@" << name << '@' << std::string_view(raw_indent, addtional_len);
+  else out << "Token@" << name;
+  out << " (" << pos.line << ", " << pos.col << ')';
 }
 
 void
@@ -58,6 +44,7 @@ Token::init(){
   len = 0;
   raw_literal = 0;
   addtional_len = 0;
+  int_value = 0;
 }
 
 }
\ No newline at end of file
@@ -25,5 +25,12 @@ string_equal(char const* s1, char const* s2, unsigned len){
   return strlen(s2) == len && memcmp(s1, s2, len) == 0;
 }
 
+void
+Sink::flush(){
+  if(!file || buf.empty()) return;
+  std::fwrite(buf.data(), 1, buf.size(), file);
+  buf.clear();
+}
+
 }
 }
\ No newline at end of file